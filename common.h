@@ -3,12 +3,15 @@
  * @author eikendev
  * @date 2018-01-16
  * @brief This module contains common declarations of the project.
- * @details Common declarations include the number of vaults and structs to handle ioctl calls.
+ * @details Common declarations include the number of vaults and structs to handle ioctl calls. The structs only use fixed-width fields with explicit padding, and pass pointers as 64-bit integers, so 32-bit and 64-bit processes share one layout.
  */
 
 #ifndef __COMMON_H__
 #define __COMMON_H__
 
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
 /**
  * @brief The number of vaults to use.
  */
@@ -24,6 +27,128 @@
  */
 #define MAX_DATA 1048576
 
+/**
+ * @brief The maximum number of partitions of a vault.
+ */
+#define MAX_PARTITIONS 64
+
+/**
+ * @brief The maximum length of the name of a partition.
+ */
+#define PARTNAME 15
+
+/**
+ * @brief The maximum number of targets of a fan-out write.
+ */
+#define MAX_FANOUT 256
+
+/**
+ * @brief Flag to keep one copy of the vault per NUMA node.
+ * @details Reads are served from the copy on the node of the reading CPU, writes are applied to all copies.
+ */
+#define VAULT_REPLICATED 0x1
+
+/**
+ * @brief Flag to allow the owner to map the encrypted vault read-only.
+ * @details Together with the key handle, the owner can then decrypt the vault in userspace.
+ */
+#define VAULT_MAPPABLE 0x2
+
+/**
+ * @brief Flag to divide the vault into stripes with their own lock and storage.
+ * @details The stripes are spread across the online NUMA nodes, and requests spanning several stripes are split.
+ */
+#define VAULT_STRIPED 0x4
+
+/**
+ * @brief Flag to store identical blocks of the vault only once.
+ * @details Blocks are found by a hash of their plaintext that is keyed per vault, and shared blocks are copied when they are written.
+ */
+#define VAULT_DEDUP 0x8
+
+/**
+ * @brief Flag to use the vault as a queue of messages.
+ * @details Every write enqueues one message and every read dequeues one, after which its storage is cleared.
+ */
+#define VAULT_QUEUE 0x10
+
+/**
+ * @brief Flag to persist the vault in a backing file, with a journal of its modifications.
+ * @details The vault is recovered from the backing file and the committed part of the journal when it is created again with the same id and size. Keys are never persisted.
+ */
+#define VAULT_PERSISTENT 0x20
+
+/**
+ * @brief The size of the blocks that are deduplicated.
+ */
+#define DEDUP_BLOCK 4096
+
+/**
+ * @brief The granularity in which vaults are compared, the size of the blocks of deduplicated vaults.
+ */
+#define DIFF_BLOCK DEDUP_BLOCK
+
+/**
+ * @brief The path of the records of all vaults in debugfs, see `struct vault_record_t`.
+ */
+#define RECORDS_PATH "/sys/kernel/debug/secvault/vaults"
+
+/**
+ * @brief The maximum number of ranges in which two vaults can differ.
+ */
+#define MAX_DIFF_RANGES (MAX_DATA / DIFF_BLOCK)
+
+/**
+ * @brief Magic number of the ioctl commands on the vault devices.
+ */
+#define VAULT_IOC_MAGIC 'S'
+
+/**
+ * @brief Get the key handle of a mappable vault.
+ */
+#define VAULT_IOC_GET_KEY _IOR(VAULT_IOC_MAGIC, 1, struct key_msg_t)
+
+/**
+ * @brief Get the generation and sizes of a vault without taking its lock.
+ */
+#define VAULT_IOC_GET_INFO _IOR(VAULT_IOC_MAGIC, 2, struct vault_info_t)
+
+/**
+ * @brief Read from a vault only if its generation differs from the given one.
+ */
+#define VAULT_IOC_COND_READ _IOWR(VAULT_IOC_MAGIC, 3, struct cond_read_t)
+
+/**
+ * @brief Return value of a conditional read if the vault was not modified.
+ */
+#define VAULT_NOT_MODIFIED 1
+
+/**
+ * @brief Restrict an opened vault to one of its partitions.
+ * @details Only the name of the message is used. The selection cannot be changed afterwards.
+ */
+#define VAULT_IOC_SELECT _IOW(VAULT_IOC_MAGIC, 4, struct part_msg_t)
+
+/**
+ * @brief Write one payload into many vaults, issued on the ioctl device.
+ */
+#define SV_CTL_FANOUT _IOWR(VAULT_IOC_MAGIC, 64, struct fanout_msg_t)
+
+/**
+ * @brief Add a partition to a vault, issued on the ioctl device.
+ */
+#define SV_CTL_ADD_PARTITION _IOW(VAULT_IOC_MAGIC, 65, struct part_msg_t)
+
+/**
+ * @brief Remove a partition from a vault, issued on the ioctl device.
+ */
+#define SV_CTL_DEL_PARTITION _IOW(VAULT_IOC_MAGIC, 66, struct part_msg_t)
+
+/**
+ * @brief Compare two vaults and get the ranges in which they differ, issued on the ioctl device.
+ */
+#define SV_CTL_DIFF _IOWR(VAULT_IOC_MAGIC, 67, struct diff_msg_t)
+
 /**
  * @brief Types of ioctl commands for the client.
  */
@@ -31,7 +156,14 @@ enum vault_cmd {
 	CREATE, ///< Create the vault.
 	CHANGE_KEY, ///< Change the encryption key of the vault.
 	ERASE, ///< Erase the vault.
-	DELETE ///< Delete the vault.
+	DELETE, ///< Delete the vault.
+	INFO, ///< Print information about the vault.
+	ADD_PARTITION, ///< Add a partition to the vault.
+	DEL_PARTITION, ///< Remove a partition from the vault.
+	PUT, ///< Copy a file into the vault.
+	GET, ///< Copy the vault into a file.
+	DIFF, ///< Compare the vault with another one.
+	LIST ///< Print the records of all vaults.
 };
 
 /**
@@ -39,8 +171,119 @@ enum vault_cmd {
  */
 struct msg_t {
 	char key[KEYSIZE + 1]; ///< Key used to encrypt the vault.
-	unsigned long size; ///< Size of the vault.
-	unsigned int device; ///< Identification number of the vault.
+	__u8 pad[5]; ///< Padding, must be zero.
+	__aligned_u64 size; ///< Size of the vault.
+	__u32 device; ///< Identification number of the vault.
+	__u32 flags; ///< Flags used when creating the vault.
+	__aligned_u64 stripe_size; ///< Size of each stripe of a striped vault, a power of two.
+};
+
+/**
+ * @brief Struct of the key handle passed to the owner of a mappable vault.
+ * @details The handle is the key of the vault itself rather than a handle bound to the open file, so it stays usable after the file is closed. A key change is not propagated to it: data written before the change stays encrypted with the old key, data written after it with the new one.
+ */
+struct key_msg_t {
+	__aligned_u64 generation; ///< Generation of the vault when the key was fetched.
+	char key[KEYSIZE]; ///< Key used to decrypt the mapped vault.
+	__u8 pad[6]; ///< Padding, must be zero.
+};
+
+/**
+ * @brief Struct of the information about a vault.
+ */
+struct vault_info_t {
+	__aligned_u64 generation; ///< Generation of the vault, increased on every modification.
+	__aligned_u64 size; ///< Size of the vault.
+	__aligned_u64 used_space; ///< Currently used size of the vault.
+};
+
+/**
+ * @brief Struct of a conditional read message.
+ */
+struct cond_read_t {
+	__aligned_u64 generation; ///< Generation known to the caller, set to the current one by the kernel.
+	__aligned_u64 buffer; ///< Address of the buffer to read into.
+	__aligned_u64 len; ///< Length of the buffer, set to the number of bytes read by the kernel.
+	__aligned_u64 offset; ///< Offset in the vault to read from.
+};
+
+/**
+ * @brief Struct of a partition message.
+ */
+struct part_msg_t {
+	char name[PARTNAME + 1]; ///< Name of the partition.
+	char key[KEYSIZE + 1]; ///< Key used to encrypt the partition.
+	__u8 pad[5]; ///< Padding, must be zero.
+	__aligned_u64 size; ///< Size of the partition.
+	__u32 device; ///< Identification number of the vault.
+	__u32 owner; ///< User that is granted access to the partition.
+};
+
+/**
+ * @brief Struct of a single target of a fan-out write.
+ */
+struct fanout_target_t {
+	__u32 device; ///< Identification number of the vault.
+	char partition[PARTNAME + 1]; ///< Name of the partition to write to, empty for the whole vault.
+	__u8 pad[4]; ///< Padding, must be zero.
+	__aligned_u64 offset; ///< Offset in the vault to write the payload to.
+	__s64 status; ///< Number of bytes written or negative error code, set by the kernel.
+};
+
+/**
+ * @brief Struct of a fan-out write message.
+ */
+struct fanout_msg_t {
+	__aligned_u64 payload; ///< The address of the plaintext to write.
+	__aligned_u64 len; ///< The length of the payload.
+	__aligned_u64 targets; ///< The address of the targets to write the payload to.
+	__u32 n_targets; ///< The number of targets.
+	__u32 pad; ///< Padding, must be zero.
+};
+
+/**
+ * @brief Struct of a range in which two vaults differ.
+ */
+struct diff_range_t {
+	__aligned_u64 offset; ///< Offset of the range.
+	__aligned_u64 len; ///< Length of the range.
+};
+
+/**
+ * @brief Struct of a diff message.
+ */
+struct diff_msg_t {
+	__u32 device; ///< Identification number of the first vault.
+	__u32 other; ///< Identification number of the second vault.
+	__aligned_u64 ranges; ///< The address of the buffer for the differing ranges.
+	__u32 max_ranges; ///< The number of ranges the buffer can hold.
+	__u32 n_ranges; ///< The number of differing ranges, set by the kernel. Only the first `max_ranges` are stored.
+	__aligned_u64 compared; ///< The number of bytes compared, set by the kernel.
+};
+
+/**
+ * @brief Struct of the record of one vault.
+ * @details Reading `RECORDS_PATH` yields one record per vault, in the order of the vault ids. The records hold metadata and counters only, never keys or data.
+ */
+struct vault_record_t {
+	__u32 id; ///< Identification number of the vault.
+	__u32 in_use; ///< Specifies whether the vault is created.
+	__u32 flags; ///< Flags the vault was created with.
+	__u32 owner; ///< User that created the vault.
+	__aligned_u64 generation; ///< Generation of the vault.
+	__aligned_u64 size; ///< Size of the vault.
+	__aligned_u64 used_space; ///< Currently used size of the vault, or the queued bytes of a queue vault.
+	__aligned_u64 storage; ///< Bytes allocated for the storage of the vault, including all copies.
+	__u32 partitions; ///< Number of partitions of the vault.
+	__u32 mappings; ///< Number of userspace mappings of the vault.
+	__aligned_u64 combined; ///< Number of small requests executed in batches.
+	__aligned_u64 batches; ///< Number of batches of small requests.
+	__aligned_u64 lockless_fallbacks; ///< Number of lockless reads that fell back to the lock.
+	__aligned_u64 scrub_pending; ///< Chunks still to be cleared after an erase, one bit per chunk.
+	__aligned_u64 dedup_blocks; ///< Blocks of a deduplicated vault that hold data.
+	__aligned_u64 dedup_stored; ///< Distinct blocks stored by a deduplicated vault.
+	__aligned_u64 queue_sent; ///< Messages enqueued into a queue vault.
+	__aligned_u64 queue_received; ///< Messages dequeued from a queue vault.
 };
 
 #endif
@@ -7,6 +7,7 @@
  */
 
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/fs.h>
 #include <linux/cdev.h>
 #include <linux/device.h>
@@ -16,10 +17,34 @@
 #include <linux/sched.h>
 #include <linux/cred.h>
 #include <linux/version.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/llist.h>
+#include <linux/wait.h>
+#include <linux/cgroup.h>
+#include <linux/hashtable.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/ktime.h>
+#include <linux/seqlock.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/siphash.h>
+#include <linux/random.h>
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/crc32.h>
+#include <linux/mutex.h>
 
 #include <asm/uaccess.h>
 
 #include "common.h"
+#include "transform.h"
 
 /**
  * @brief Major device number for the created devices.
@@ -31,321 +56,5098 @@
  */
 #define MODNAME "secvault"
 
+/**
+ * @brief The minimum amount of data a fan-out write needs to be spread across CPUs.
+ */
+#define FANOUT_PARALLEL_MIN 65536
+
+/**
+ * @brief The maximum size of a read or write that is combined with other requests.
+ */
+#define COMBINE_MAX 256
+
+/**
+ * @brief The granularity in which erased storage is cleared in the background.
+ */
+#define SCRUB_CHUNK 65536
+
+/**
+ * @brief The delay in jiffies before background work retries after yielding to foreground requests.
+ */
+#define SCRUB_BACKOFF 1
+
+/**
+ * @brief The number of bits of the hash table of cgroup usage.
+ */
+#define CGROUP_BITS 6
+
+/**
+ * @brief The maximum number of cgroups whose usage is tracked separately.
+ */
+#define MAX_CGROUPS 256
+
+/**
+ * @brief The maximum size of a read that is served without taking the lock of the vault.
+ */
+#define SEQREAD_MAX 64
+
+/**
+ * @brief The number of attempts of a lockless read before it falls back to the lock.
+ */
+#define SEQREAD_TRIES 4
+
+/**
+ * @brief The size of the smallest class of spare storage.
+ */
+#define SPARE_MIN_SHIFT 12
+
+/**
+ * @brief The number of size classes of spare storage, the largest holds `MAX_DATA` bytes.
+ */
+#define SPARE_CLASSES 9
+
+/**
+ * @brief The maximum number of spares kept per size class.
+ */
+#define MAX_SPARES 16
+
+/**
+ * @brief The minimum size of a stripe.
+ */
+#define STRIPE_MIN 4096
+
+/**
+ * @brief The maximum number of stripes of a vault.
+ */
+#define MAX_STRIPES 64
+
+/**
+ * @brief The minimum size of a request spanning several stripes to process the stripes in parallel.
+ */
+#define STRIPE_PARALLEL_MIN 262144
+
+/**
+ * @brief The interval in jiffies in which the governor grants budget to background work.
+ */
+#define GOV_INTERVAL (HZ / 10)
+
+/**
+ * @brief The size of the header of a message in a queue vault, holding its length.
+ */
+#define QUEUE_HEADER sizeof(u32)
+
+/**
+ * @brief The offset of the storage in the backing file of a persistent vault, after its header.
+ */
+#define PERSIST_DATA 4096
+
+/**
+ * @brief The magic number of the header of a backing file.
+ */
+#define PERSIST_MAGIC 0x53565046
+
+/**
+ * @brief The magic number of a journal record.
+ */
+#define JOURNAL_MAGIC 0x53564a4c
+
+/**
+ * @brief The number of bytes logged but not committed after which a writer commits them itself before modifying the vault, or a nonblocking one fails.
+ */
+#define JOURNAL_PENDING_MAX (4UL << 20)
+
+/**
+ * @brief The size of the journal after which the backing file is made durable and the journal is restarted.
+ */
+#define JOURNAL_CHECKPOINT (16UL << 20)
+
+/**
+ * @brief The types of journal records.
+ */
+enum journal_type {
+	JOURNAL_WRITE = 1, ///< Encrypted data stored at an offset of the vault.
+	JOURNAL_ERASE, ///< The vault was erased.
+	JOURNAL_COMMIT, ///< The end of a group commit, carrying the sequence number of its last record.
+};
+
+/**
+ * @brief The number of buckets of a latency histogram, bucket `i` counts durations below `2^i` nanoseconds.
+ */
+#define LATENCY_BUCKETS 32
+
+/**
+ * @brief The phases of a read or write whose latency is measured.
+ */
+enum latency_phase {
+	PHASE_LOCK, ///< Waiting for the lock of the vault, or for the batch executing a combined request.
+	PHASE_ALLOC, ///< Allocating the buffer of the request.
+	PHASE_COPY, ///< Copying between the buffer and userspace, including page faults, or pinning the user pages.
+	PHASE_TRANSFORM, ///< Encrypting or decrypting the data and accessing the storage.
+	PHASE_TOTAL, ///< The whole request.
+	N_PHASES,
+};
+
+/**
+ * @brief Struct used to store meta information of a partition.
+ * @details A partition is an independently keyed region of the storage of a vault.
+ */
+typedef struct {
+	char name[PARTNAME + 1]; ///< The name of the partition.
+	char key[KEYSIZE]; ///< The key used to encrypt the partition.
+	unsigned long start; ///< The offset of the partition in the vault.
+	unsigned long size; ///< The size of the partition.
+	unsigned long used_space; ///< The currently used size of the partition.
+	atomic64_t generation; ///< The generation of the partition, increased on every modification.
+	atomic_t users; ///< The number of files that selected the partition.
+	uid_t owner; ///< The owner the partition was assigned to.
+	int in_use; ///< Specifies whether the partition is currently in use.
+} partition_t;
+
+/**
+ * @brief Struct used to store a stripe of a striped vault.
+ */
+typedef struct {
+	struct semaphore sem; ///< The semaphore associated with the stripe.
+	char *data; ///< The data stored in the stripe.
+	int node; ///< The node the data is allocated on.
+} stripe_t;
+
+/**
+ * @brief Struct used to store a block of a deduplicated vault.
+ * @details The block is encrypted with the cursor relative to its start, so identical plaintext yields identical blocks wherever it is stored.
+ */
+typedef struct {
+	struct hlist_node node; ///< The node in the hash table of the vault.
+	u64 hash; ///< The keyed hash of the plaintext of the block.
+	unsigned int refs; ///< The number of blocks of the vault sharing this block.
+	char *data; ///< The encrypted data of the block.
+} dedup_block_t;
+
 /**
  * @brief Struct used to store meta information of a vault.
  */
 typedef struct {
 	char key[KEYSIZE]; ///< The key used to encrypt the vault.
 	char *data; ///< The data stored in the vault.
+	char **replicas; ///< The per-node copies of the data, only set for replicated vaults.
+	atomic_long_t *node_hits; ///< The number of reads served by the replica of each node.
+	atomic_long_t remote_reads; ///< The number of reads from nodes without a replica.
+	unsigned long data_bytes; ///< The number of bytes allocated for the data, including all replicas.
 	struct cdev *driver; ///< The driver associated with the vault.
 	struct semaphore sem; ///< The semaphore associated with the vault.
 	unsigned long size; ///< The maximum size of the vault.
 	unsigned long used_space; ///< The currently used size of the vault.
 	dev_t number; ///< The device number of the driver associated with the vault.
 	uid_t owner; ///< The owner that created the vault.
+	unsigned int flags; ///< The flags the vault was created with.
+	atomic_t mappings; ///< The number of userspace mappings of the vault.
+	atomic64_t generation; ///< The generation of the vault, increased on every modification.
 	int in_use; ///< Specifies whether the vault is currently in use.
+	partition_t parts[MAX_PARTITIONS]; ///< The partitions of the vault.
+	struct llist_head pending; ///< The small requests waiting to be executed by the holder of the lock.
+	wait_queue_head_t combine_wait; ///< The queue of the threads waiting for their requests to be executed.
+	wait_queue_head_t poll_wait; ///< The queue of the threads polling for the lock of the vault to be released.
+	int locked; ///< Specifies whether the lock of the vault is held, read by pollers without taking it.
+	unsigned long combined; ///< The number of small requests executed in batches.
+	unsigned long batches; ///< The number of batches of requests executed.
+	atomic_t foreground; ///< The number of foreground requests waiting for the lock.
+	unsigned long scrub_pending; ///< The chunks of `SCRUB_CHUNK` bytes that still have to be cleared after an erase.
+	unsigned long scrub_yields; ///< The number of times the background scrub yielded to foreground requests.
+	struct delayed_work scrub_work; ///< The background work clearing erased storage.
+	u64 scrub_cgroup; ///< The cgroup that erased the vault, charged for the background scrub.
+	seqcount_t seq; ///< The sequence counter of modifications visible to lockless readers.
+	atomic_long_t seq_fallbacks; ///< The number of lockless reads that fell back to the lock.
+	stripe_t *stripes; ///< The stripes of the storage, only set for striped vaults.
+	unsigned int n_stripes; ///< The number of stripes.
+	unsigned int stripe_shift; ///< The binary logarithm of the size of a stripe.
+	atomic_t stripe_users; ///< The number of requests accessing the stripes.
+	wait_queue_head_t stripe_wait; ///< The queue of a delete waiting for the stripes to become unused.
+	unsigned long fg_last; ///< The time of the last foreground request in jiffies.
+	dedup_block_t **blocks; ///< The blocks of the storage, only set for deduplicated vaults. Blocks that were never written are `NULL`.
+	unsigned int n_blocks; ///< The number of blocks.
+	struct hlist_head *dedup_table; ///< The hash table of the stored blocks.
+	unsigned int dedup_bits; ///< The binary logarithm of the number of buckets of the hash table.
+	siphash_key_t dedup_key; ///< The key of the block hash, random for every vault.
+	unsigned long dedup_mapped; ///< The number of blocks of the vault that hold data.
+	unsigned long dedup_stored; ///< The number of distinct blocks stored.
+	struct semaphore queue_produce; ///< The semaphore of the producers of a queue vault.
+	struct semaphore queue_consume; ///< The semaphore of the consumers of a queue vault.
+	unsigned long queue_head; ///< The number of bytes ever enqueued, written by producers.
+	unsigned long queue_tail; ///< The number of bytes ever dequeued, written by consumers.
+	unsigned long queue_sent; ///< The number of messages enqueued.
+	unsigned long queue_received; ///< The number of messages dequeued.
+	atomic_long_t latency[2][N_PHASES][LATENCY_BUCKETS]; ///< The latency histograms of the sampled reads and writes, per phase.
+	struct file *backing; ///< The backing file of a persistent vault.
+	struct file *journal; ///< The journal of a persistent vault.
+	struct mutex journal_mutex; ///< The mutex serializing commits and checkpoints of the journal.
+	spinlock_t journal_lock; ///< The lock protecting the records that are not yet committed.
+	struct list_head journal_pending; ///< The records logged but not yet committed, in the order of their sequence numbers.
+	unsigned long journal_pending_bytes; ///< The size of the pending records.
+	u64 journal_seq; ///< The sequence number of the last record logged.
+	u64 journal_committed; ///< The sequence number of the last record committed.
+	u64 journal_applied; ///< The sequence number of the last record the backing file holds durably.
+	u64 journal_used; ///< The used space of the vault as of the last committed record.
+	loff_t journal_pos; ///< The end of the committed records in the journal.
+	int journal_error; ///< The first error of a commit since the last `fsync()`.
+	int journal_failed; ///< Specifies whether records may be missing from the journal, so the backing file is rewritten from the storage before the next commit.
+	struct work_struct journal_work; ///< The work committing the pending records.
+	unsigned long journal_commits; ///< The number of group commits.
+	unsigned long journal_records; ///< The number of records committed.
+	unsigned long journal_checkpoints; ///< The number of checkpoints.
 } vault_t;
 
-static dev_t dev_numbers;
-static struct class *driver_class;
+/**
+ * @brief Struct of the header of the backing file of a persistent vault.
+ * @details The storage follows at `PERSIST_DATA`, encrypted as in memory.
+ */
+typedef struct {
+	u32 magic; ///< The magic number `PERSIST_MAGIC`.
+	u32 crc; ///< The checksum of the header, computed with this field set to zero.
+	u64 size; ///< The size of the vault.
+	u64 used_space; ///< The used size of the vault.
+	u64 applied; ///< The sequence number of the last journal record the storage holds.
+} persist_header_t;
+
+/**
+ * @brief Struct of the header of a journal record.
+ * @details Write records are followed by their data.
+ */
+typedef struct {
+	u32 magic; ///< The magic number `JOURNAL_MAGIC`.
+	u32 type; ///< The type of the record, see `enum journal_type`.
+	u64 seq; ///< The sequence number of the record.
+	u64 offset; ///< The offset in the vault of the data.
+	u64 len; ///< The length of the data.
+	u64 used_space; ///< The used size of the vault after the record.
+	u32 crc; ///< The checksum of the header and the data, computed with this field set to zero.
+	u32 pad; ///< Padding, must be zero.
+} journal_header_t;
+
+/**
+ * @brief Struct of a journal record waiting to be committed.
+ */
+typedef struct {
+	struct list_head node; ///< The node in the list of pending records.
+	journal_header_t header; ///< The header of the record, directly followed by the data.
+	char data[]; ///< The data of the record.
+} journal_rec_t;
+
+/**
+ * @brief Struct of the latency measurement of a single read or write.
+ * @details The measurement lives on the stack of the request. Time is attributed to a phase whenever the phase ends, and all phases are recorded when the request ends.
+ */
+typedef struct {
+	vault_t *vault; ///< The vault the request accesses.
+	int write; ///< Specifies whether the request is a write.
+	int active; ///< Specifies whether the request is sampled.
+	unsigned int seen; ///< The phases the request passed through, one bit per phase.
+	u64 start; ///< The time the request started.
+	u64 last; ///< The time the last phase ended.
+	u64 ns[N_PHASES]; ///< The time spent in each phase.
+} latency_t;
+
+/**
+ * @brief Struct of the CPU time of a cgroup accumulated on one CPU.
+ */
+struct cgroup_time {
+	u64 transform_ns; ///< The time spent encrypting and decrypting data of the cgroup.
+	u64 deferred_ns; ///< The time spent by workers on behalf of the cgroup.
+};
+
+/**
+ * @brief Struct used to accumulate the CPU time spent on behalf of a cgroup.
+ */
+typedef struct {
+	struct hlist_node node; ///< The node in the hash table of cgroup usage.
+	u64 id; ///< The id of the cgroup.
+	struct cgroup_time __percpu *time; ///< The time spent on behalf of the cgroup, per CPU so readers on different CPUs do not share it.
+} cgroup_usage_t;
+
+/**
+ * @brief Struct of the pre-zeroed spare storage of one size class.
+ */
+typedef struct {
+	spinlock_t lock; ///< The lock protecting the pool.
+	char *spares[MAX_SPARES]; ///< The zeroed buffers ready to be claimed.
+	unsigned int count; ///< The number of buffers in the pool.
+	int wanted; ///< Specifies whether storage of this class was requested, so the pool is kept filled.
+} spare_pool_t;
+
+/**
+ * @brief Struct of the governor of background work.
+ * @details The governor grants background work a budget of CPU time per interval, depending on the foreground load and the idle time of the system.
+ */
+typedef struct {
+	struct delayed_work work; ///< The periodic work of the governor.
+	atomic64_t budget_ns; ///< The CPU time background work may still use in the current interval.
+	atomic_long_t throttled; ///< The number of times background work was deferred for lack of budget.
+	unsigned long last_run; ///< The time of the last run in jiffies.
+	u64 last_idle_us; ///< The idle time of all CPUs at the last run.
+	u64 last_wall_us; ///< The wall time at the last run.
+	unsigned long last_requests; ///< The number of foreground requests at the last run.
+	unsigned int idle_pct; ///< The share of idle CPU time in the last interval.
+	unsigned long fg_rate; ///< The foreground requests per second in the last interval.
+	int accelerated; ///< Specifies whether background work runs unthrottled, as the system is idle.
+} governor_t;
+
+/**
+ * @brief The priority classes of vault work.
+ */
+enum vault_class {
+	CLASS_INTERACTIVE, ///< Latency-sensitive work on behalf of a waiting caller.
+	CLASS_BULK, ///< Throughput-oriented work on behalf of a waiting caller.
+	CLASS_BACKGROUND, ///< Maintenance work nobody waits for, which yields to foreground requests.
+	N_CLASSES,
+};
+
+/**
+ * @brief Struct describing the region of a vault that is accessed.
+ * @details This is either the whole vault or one of its partitions.
+ */
+typedef struct {
+	char *key; ///< The key of the region.
+	unsigned long start; ///< The offset of the region in the vault.
+	unsigned long size; ///< The size of the region.
+	unsigned long *used_space; ///< The currently used size of the region.
+	atomic64_t *generation; ///< The generation of the region.
+} region_t;
+
+/**
+ * @brief Struct describing a small read or write waiting to be executed.
+ * @details The request lives on the stack of the submitting thread. Whoever holds the lock of the vault executes it, so userspace is only accessed by the submitter, and the data passes through `buffer`.
+ */
+typedef struct {
+	struct llist_node node; ///< The node in the list of pending requests.
+	int write; ///< Specifies whether the request is a write.
+	int part_idx; ///< The index of the partition to access, negative value for the whole vault.
+	uid_t uid; ///< The user that submitted the request.
+	u64 cgroup; ///< The cgroup of the submitter.
+	int numa; ///< The node of the submitter, whose copy of a replicated vault is read.
+	loff_t offset; ///< The offset in the region to access.
+	size_t len; ///< The length of the data to access.
+	char *key; ///< The key of the region, only valid while the batch is executed.
+	unsigned long start; ///< The offset of the region in the vault, only valid while the batch is executed.
+	ssize_t result; ///< Negative value on error, size of the data read or written otherwise.
+	int skip; ///< Specifies whether the request is complete before the transform, only valid while the batch is executed.
+	int done; ///< Specifies whether the request was executed, after which it must not be touched.
+	journal_rec_t *rec; ///< The journal record reserved for a write by the submitter, `NULL` once it is logged.
+	char buffer[COMBINE_MAX]; ///< The data read or to be written.
+} combine_op_t;
+
+static dev_t dev_numbers;
+static struct class *driver_class;
+
+static dev_t ioctl_number;
+static struct cdev *ioctl_driver;
+static struct device *ioctl_dev;
+
+static struct dentry *debugfs_dir;
+
+/**
+ * @brief The number of bytes allocated for the data of all vaults.
+ */
+static atomic_long_t storage_bytes;
+
+/**
+ * @brief The number of vaults that have data allocated.
+ */
+static atomic_long_t storage_allocs;
+
+static vault_t vaults[N_VAULTS];
+
+/**
+ * @brief The CPU time spent on behalf of each cgroup.
+ * @details Entries are added under `cgroup_lock` and never removed before the module is unloaded, so they can be looked up under RCU.
+ */
+static DEFINE_HASHTABLE(cgroup_usage, CGROUP_BITS);
+static DEFINE_SPINLOCK(cgroup_lock);
+static unsigned int n_cgroups;
+
+/**
+ * @brief The CPU time of cgroups that did not fit into the hash table.
+ */
+static cgroup_usage_t cgroup_other;
+static DEFINE_PER_CPU(struct cgroup_time, cgroup_other_time);
+
+/**
+ * @brief The worker pools of the priority classes.
+ */
+static struct workqueue_struct *class_wq[N_CLASSES];
+
+/**
+ * @brief The pools of spare storage, one per size class.
+ */
+static spare_pool_t spare_pools[SPARE_CLASSES];
+
+/**
+ * @brief The work filling the pools of spare storage.
+ */
+static struct delayed_work spare_work;
+
+/**
+ * @brief The number of vaults created with spare storage.
+ */
+static atomic_long_t spare_hits;
+
+/**
+ * @brief The number of vaults that found no spare storage and allocated it themselves.
+ */
+static atomic_long_t spare_misses;
+
+/**
+ * @brief The number of reads and writes that accessed the user pages directly.
+ */
+static atomic_long_t zerocopy_requests;
+
+/**
+ * @brief The number of reads and writes above the threshold whose user pages could not be pinned.
+ */
+static atomic_long_t zerocopy_fallbacks;
+
+/**
+ * @brief The number of non-blocking reads and writes.
+ */
+static atomic_long_t nowait_requests;
+
+/**
+ * @brief The number of non-blocking reads and writes that failed with `-EAGAIN`, as they would have had to wait.
+ */
+static atomic_long_t nowait_busy;
+
+static unsigned int zerocopy_min = 65536;
+module_param(zerocopy_min, uint, 0644);
+MODULE_PARM_DESC(zerocopy_min, "Minimum size in bytes of a read or write that transforms directly between the user pages and the storage (0 to disable)");
+
+/**
+ * @brief The number of reads and writes started on each CPU, used to sample them.
+ */
+static DEFINE_PER_CPU(unsigned int, latency_tick);
+
+static unsigned int latency_sample = 64;
+module_param(latency_sample, uint, 0644);
+MODULE_PARM_DESC(latency_sample, "Measure the latency of every n-th read and write per CPU (0 to disable)");
+
+static char *persist_dir = "/var/lib/secvault";
+module_param(persist_dir, charp, 0444);
+MODULE_PARM_DESC(persist_dir, "Directory of the backing files and journals of persistent vaults");
+
+static unsigned int spare_depth = 2;
+module_param(spare_depth, uint, 0644);
+MODULE_PARM_DESC(spare_depth, "Number of pre-zeroed spares kept per requested size class (at most 16, 0 to disable)");
+
+/**
+ * @brief The governor of background work.
+ */
+static governor_t governor;
+
+/**
+ * @brief The number of foreground requests served by each CPU.
+ */
+static DEFINE_PER_CPU(unsigned long, fg_requests);
+
+static unsigned int bg_share = 10;
+module_param(bg_share, uint, 0644);
+MODULE_PARM_DESC(bg_share, "Share of one CPU in percent that background work may use while the system is busy");
+
+static unsigned int idle_threshold = 90;
+module_param(idle_threshold, uint, 0644);
+MODULE_PARM_DESC(idle_threshold, "Idle share of the system in percent above which background work runs unthrottled");
+
+static unsigned int interactive_workers;
+module_param(interactive_workers, uint, 0444);
+MODULE_PARM_DESC(interactive_workers, "Maximum concurrent interactive work items per CPU (0 for the default)");
+
+static unsigned int bulk_workers;
+module_param(bulk_workers, uint, 0444);
+MODULE_PARM_DESC(bulk_workers, "Maximum concurrent bulk work items (0 for the default)");
+
+static unsigned int background_workers = 1;
+module_param(background_workers, uint, 0444);
+MODULE_PARM_DESC(background_workers, "Maximum concurrent background work items (0 for the default)");
+
+/**
+ * @brief Begin a modification that is visible to lockless readers.
+ * @details The caller must hold the lock of the vault. The modification may copy up to a whole vault, so it stays preemptible: lockless readers that find it in progress do not spin on it, see `vault_seq_wait()`.
+ * @param vault The vault to modify.
+ */
+static void vault_seq_begin(vault_t *vault)
+{
+	raw_write_seqcount_begin(&vault->seq);
+}
+
+/**
+ * @brief End a modification that is visible to lockless readers.
+ * @param vault The modified vault.
+ */
+static void vault_seq_end(vault_t *vault)
+{
+	raw_write_seqcount_end(&vault->seq);
+}
+
+/**
+ * @brief Wait until no modification of a vault is in progress and begin a lockless read.
+ * @details The writer may be preempted, so the CPU is yielded while waiting. The caller must not be in an RCU read-side critical section.
+ * @param vault The vault to read.
+ * @return The sequence number to check the read with `read_seqcount_retry()`.
+ */
+static unsigned int vault_seq_wait(vault_t *vault)
+{
+	unsigned int seq;
+
+	while ((seq = raw_read_seqcount(&vault->seq)) & 1)
+		cond_resched();
+
+	return seq;
+}
+
+/**
+ * @brief Drop a reference to a block of a deduplicated vault.
+ * @details The block is freed once no block of the vault shares it anymore.
+ * @param vault The vault the block belongs to.
+ * @param block The block to release.
+ */
+static void dedup_put(vault_t *vault, dedup_block_t *block)
+{
+	if (--block->refs > 0)
+		return;
+
+	hlist_del(&block->node);
+	kfree(block->data);
+	kfree(block);
+
+	vault->dedup_stored--;
+	vault->data_bytes -= DEDUP_BLOCK;
+	atomic_long_sub(DEDUP_BLOCK, &storage_bytes);
+}
+
+/**
+ * @brief Drop all blocks of a deduplicated vault.
+ * @details Afterwards, every block of the vault reads as zero.
+ * @param vault The vault to drop the blocks of.
+ */
+static void dedup_drop_all(vault_t *vault)
+{
+	int i;
+
+	for (i = 0; i < vault->n_blocks; i++) {
+		if (vault->blocks[i] != NULL) {
+			dedup_put(vault, vault->blocks[i]);
+			vault->blocks[i] = NULL;
+		}
+	}
+
+	vault->dedup_mapped = 0;
+}
+
+/**
+ * @brief Free the storage of a vault.
+ * @details For replicated vaults, all per-node copies are released as well, for striped vaults all stripes once no request uses them, and for deduplicated vaults all blocks. Lockless readers might still copy from the storage, so it is only released after a grace period.
+ * @param vault The vault to free the storage of.
+ */
+static void vault_free_data(vault_t *vault)
+{
+	int node, i;
+
+	if (vault->data != NULL)
+		synchronize_rcu();
+
+	if (vault->stripes != NULL) {
+		// Requests that saw the vault in use are counted once the grace period ends.
+		synchronize_rcu();
+		wait_event(vault->stripe_wait, atomic_read(&vault->stripe_users) == 0);
+
+		for (i = 0; i < vault->n_stripes; i++)
+			kfree(vault->stripes[i].data);
+
+		kfree(vault->stripes);
+		vault->stripes = NULL;
+		vault->n_stripes = 0;
+	}
+
+	if (vault->blocks != NULL) {
+		dedup_drop_all(vault);
+
+		kfree(vault->blocks);
+		kfree(vault->dedup_table);
+		vault->blocks = NULL;
+		vault->dedup_table = NULL;
+		vault->n_blocks = 0;
+		memzero_explicit(&vault->dedup_key, sizeof(vault->dedup_key));
+	}
+
+	if (vault->replicas != NULL) {
+		for_each_node(node)
+			kfree(vault->replicas[node]);
+
+		kfree(vault->replicas);
+		vault->replicas = NULL;
+	} else {
+		kvfree(vault->data);
+	}
+
+	kfree(vault->node_hits);
+	vault->node_hits = NULL;
+	vault->data = NULL;
+
+	if (vault->data_bytes > 0) {
+		atomic_long_sub(vault->data_bytes, &storage_bytes);
+		atomic_long_dec(&storage_allocs);
+		vault->data_bytes = 0;
+	}
+}
+
+/**
+ * @brief Get the amount of outstanding background work.
+ * @return The number of erased chunks still to be cleared plus the number of missing spares.
+ */
+static unsigned long governor_backlog(void)
+{
+	unsigned int depth = min_t(unsigned int, READ_ONCE(spare_depth), MAX_SPARES);
+	unsigned long backlog = 0;
+	int i;
+
+	for (i = 0; i < N_VAULTS; i++)
+		backlog += hweight_long(READ_ONCE(vaults[i].scrub_pending));
+
+	for (i = 0; i < SPARE_CLASSES; i++) {
+		if (READ_ONCE(spare_pools[i].wanted) && READ_ONCE(spare_pools[i].count) < depth)
+			backlog += depth - READ_ONCE(spare_pools[i].count);
+	}
+
+	return backlog;
+}
+
+/**
+ * @brief Grant background work its budget for the next interval.
+ * @details The idle share of the system and the foreground request rate are sampled since the last run. If the system was idle enough, background work may use all CPUs, otherwise `bg_share` percent of one CPU. The governor stops when there is no backlog.
+ * @param work Unused.
+ */
+static void governor_run(struct work_struct *work)
+{
+	u64 interval_ns = jiffies_to_nsecs(GOV_INTERVAL);
+	u64 idle_us = 0, wall_us = 0, cpu_idle, cpu_wall;
+	unsigned long requests = 0, elapsed;
+	int cpu, sampled = 1;
+
+	for_each_online_cpu(cpu) {
+		cpu_idle = get_cpu_idle_time_us(cpu, &cpu_wall);
+		if (cpu_idle == (u64)-1)
+			sampled = 0;
+
+		idle_us += cpu_idle;
+		wall_us = cpu_wall;
+	}
+
+	for_each_possible_cpu(cpu)
+		requests += per_cpu(fg_requests, cpu);
+
+	elapsed = jiffies - governor.last_run;
+
+	// Samples older than a few intervals do not describe the current load.
+	if (sampled && governor.last_run != 0 && elapsed > 0 && elapsed <= 2 * GOV_INTERVAL &&
+			wall_us > governor.last_wall_us) {
+		governor.idle_pct = div64_u64(100 * (idle_us - governor.last_idle_us),
+				(wall_us - governor.last_wall_us) * num_online_cpus());
+		governor.fg_rate = (requests - governor.last_requests) * HZ / elapsed;
+	} else {
+		governor.idle_pct = 0;
+		governor.fg_rate = 0;
+	}
+
+	governor.last_run = jiffies;
+	governor.last_idle_us = idle_us;
+	governor.last_wall_us = wall_us;
+	governor.last_requests = requests;
+
+	governor.accelerated = governor.idle_pct >= READ_ONCE(idle_threshold);
+
+	if (governor.accelerated)
+		atomic64_set(&governor.budget_ns, interval_ns * num_online_cpus());
+	else
+		atomic64_set(&governor.budget_ns, div_u64(interval_ns * min(READ_ONCE(bg_share), 100U), 100));
+
+	if (governor_backlog() > 0)
+		queue_delayed_work(class_wq[CLASS_BACKGROUND], &governor.work, GOV_INTERVAL);
+}
+
+/**
+ * @brief Make sure the governor runs while there is background work.
+ * @details A governor that stopped is started right away, otherwise its current interval is kept.
+ */
+static void governor_kick(void)
+{
+	unsigned long delay = GOV_INTERVAL;
+
+	if (time_after(jiffies, READ_ONCE(governor.last_run) + 2 * GOV_INTERVAL))
+		delay = 0;
+
+	queue_delayed_work(class_wq[CLASS_BACKGROUND], &governor.work, delay);
+}
+
+/**
+ * @brief Check whether background work may run another step.
+ * @details If not, the caller has to defer the step to the next interval.
+ * @return `1` if budget is left, `0` otherwise.
+ */
+static int governor_allow(void)
+{
+	if (atomic64_read(&governor.budget_ns) > 0)
+		return 1;
+
+	atomic_long_inc(&governor.throttled);
+	governor_kick();
+
+	return 0;
+}
+
+/**
+ * @brief Charge a step of background work to the budget.
+ * @param start The start of the step, as returned by `ktime_get_ns()`.
+ */
+static void governor_charge(u64 start)
+{
+	atomic64_sub(ktime_get_ns() - start, &governor.budget_ns);
+}
+
+/**
+ * @brief Record a foreground request on a vault.
+ * @details The time of the last request is only written once per jiffy, so readers on different CPUs rarely share the cache line.
+ * @param vault The vault of the request.
+ */
+static void governor_note(vault_t *vault)
+{
+	this_cpu_inc(fg_requests);
+
+	if (READ_ONCE(vault->fg_last) != jiffies)
+		WRITE_ONCE(vault->fg_last, jiffies);
+}
+
+/**
+ * @brief Check whether a vault served foreground requests in the current interval.
+ * @param vault The vault to check.
+ * @return `1` if the vault is busy, `0` otherwise.
+ */
+static int governor_busy(vault_t *vault)
+{
+	return time_before(jiffies, READ_ONCE(vault->fg_last) + GOV_INTERVAL);
+}
+
+/**
+ * @brief Get the size class of spare storage that fits a size.
+ * @param size The size of the storage.
+ * @return The size class.
+ */
+static unsigned int spare_class(unsigned long size)
+{
+	if (size <= 1UL << SPARE_MIN_SHIFT)
+		return 0;
+
+	return order_base_2(size) - SPARE_MIN_SHIFT;
+}
+
+/**
+ * @brief Claim pre-zeroed storage from the pool of its size class.
+ * @details The pool is refilled in the background, also after a miss, so the next request of the same class finds a spare.
+ * @param size The size of the storage.
+ * @param bytes The number of bytes of the claimed buffer.
+ * @return The claimed buffer, `NULL` if the pool is empty.
+ */
+static char *spare_claim(unsigned long size, unsigned long *bytes)
+{
+	spare_pool_t *pool = &spare_pools[spare_class(size)];
+	char *buffer = NULL;
+
+	spin_lock(&pool->lock);
+
+	pool->wanted = 1;
+
+	if (pool->count > 0)
+		buffer = pool->spares[--pool->count];
+
+	spin_unlock(&pool->lock);
+
+	if (buffer != NULL)
+		atomic_long_inc(&spare_hits);
+	else
+		atomic_long_inc(&spare_misses);
+
+	if (READ_ONCE(spare_depth) > 0) {
+		queue_delayed_work(class_wq[CLASS_BACKGROUND], &spare_work, 0);
+		governor_kick();
+	}
+
+	*bytes = 1UL << (SPARE_MIN_SHIFT + spare_class(size));
+
+	return buffer;
+}
+
+/**
+ * @brief Fill the pools of the requested size classes up to `spare_depth`.
+ * @details Pools above the depth, because it was lowered, are shrunk. Filling is paced by the governor.
+ * @param work Unused.
+ */
+static void spare_fill(struct work_struct *work)
+{
+	unsigned int depth = min_t(unsigned int, READ_ONCE(spare_depth), MAX_SPARES);
+	spare_pool_t *pool;
+	char *buffer;
+	u64 start;
+	int c;
+
+	for (c = 0; c < SPARE_CLASSES; c++) {
+		pool = &spare_pools[c];
+
+		for (;;) {
+			buffer = NULL;
+
+			spin_lock(&pool->lock);
+			if (pool->count > depth)
+				buffer = pool->spares[--pool->count];
+			spin_unlock(&pool->lock);
+
+			if (buffer == NULL)
+				break;
+
+			kfree(buffer);
+		}
+
+		while (READ_ONCE(pool->wanted) && READ_ONCE(pool->count) < depth) {
+			if (!governor_allow()) {
+				queue_delayed_work(class_wq[CLASS_BACKGROUND], &spare_work, GOV_INTERVAL);
+				return;
+			}
+
+			start = ktime_get_ns();
+			buffer = kzalloc(1UL << (SPARE_MIN_SHIFT + c), GFP_KERNEL);
+			governor_charge(start);
+
+			if (buffer == NULL)
+				return;
+
+			spin_lock(&pool->lock);
+			if (pool->count < depth) {
+				pool->spares[pool->count++] = buffer;
+				buffer = NULL;
+			}
+			spin_unlock(&pool->lock);
+
+			kfree(buffer);
+		}
+	}
+}
+
+/**
+ * @brief Free the spare storage of all pools.
+ * @details The fill work must not run anymore.
+ */
+static void spare_free_all(void)
+{
+	spare_pool_t *pool;
+	int c;
+
+	for (c = 0; c < SPARE_CLASSES; c++) {
+		pool = &spare_pools[c];
+
+		while (pool->count > 0)
+			kfree(pool->spares[--pool->count]);
+	}
+}
+
+/**
+ * @brief Account the data of a vault that was allocated successfully.
+ * @param vault The vault the data was allocated for.
+ * @param bytes The number of bytes allocated.
+ * @return `0`.
+ */
+static int vault_account_data(vault_t *vault, unsigned long bytes)
+{
+	vault->data_bytes = bytes;
+	atomic_long_add(bytes, &storage_bytes);
+	atomic_long_inc(&storage_allocs);
+
+	return 0;
+}
+
+/**
+ * @brief Allocate zeroed stripes for a vault.
+ * @details The stripes are assigned to the online nodes in turn. The size of a stripe must be set in `vault->stripe_shift`.
+ * @param vault The vault to allocate the stripes for.
+ * @param size The size of the storage in bytes.
+ * @return `0` on success, negative value otherwise.
+ */
+static int vault_alloc_stripes(vault_t *vault, unsigned long size)
+{
+	unsigned long stripe_size = 1UL << vault->stripe_shift;
+	unsigned long len;
+	stripe_t *stripe;
+	int node = first_online_node;
+	int i;
+
+	vault->n_stripes = DIV_ROUND_UP(size, stripe_size);
+	vault->stripes = kcalloc(vault->n_stripes, sizeof(stripe_t), GFP_KERNEL);
+	if (vault->stripes == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < vault->n_stripes; i++) {
+		stripe = &vault->stripes[i];
+		len = min(stripe_size, size - i * stripe_size);
+
+		sema_init(&stripe->sem, 1);
+		stripe->node = node;
+		stripe->data = kzalloc_node(len, GFP_KERNEL, node);
+		if (stripe->data == NULL) {
+			vault_free_data(vault);
+			return -ENOMEM;
+		}
+
+		node = next_online_node(node);
+		if (node >= MAX_NUMNODES)
+			node = first_online_node;
+	}
+
+	return vault_account_data(vault, size);
+}
+
+/**
+ * @brief Allocate the block map of a deduplicated vault.
+ * @details No block is stored until it is written. The hash table gets about one bucket per block, and a fresh key for the block hash is drawn.
+ * @param vault The vault to allocate the map for.
+ * @param size The size of the storage in bytes.
+ * @return `0` on success, negative value otherwise.
+ */
+static int vault_alloc_blocks(vault_t *vault, unsigned long size)
+{
+	vault->n_blocks = DIV_ROUND_UP(size, DEDUP_BLOCK);
+	vault->dedup_bits = order_base_2(vault->n_blocks);
+
+	vault->blocks = kcalloc(vault->n_blocks, sizeof(dedup_block_t *), GFP_KERNEL);
+	vault->dedup_table = kcalloc(1UL << vault->dedup_bits, sizeof(struct hlist_head), GFP_KERNEL);
+	if (vault->blocks == NULL || vault->dedup_table == NULL) {
+		kfree(vault->blocks);
+		kfree(vault->dedup_table);
+		vault->blocks = NULL;
+		vault->dedup_table = NULL;
+		vault->n_blocks = 0;
+		return -ENOMEM;
+	}
+
+	get_random_bytes(&vault->dedup_key, sizeof(vault->dedup_key));
+	vault->dedup_mapped = 0;
+	vault->dedup_stored = 0;
+
+	return vault_account_data(vault, vault->n_blocks * sizeof(dedup_block_t *) +
+			(1UL << vault->dedup_bits) * sizeof(struct hlist_head));
+}
+
+/**
+ * @brief Allocate zeroed storage for a vault.
+ * @details Striped vaults get one allocation per stripe, deduplicated vaults a map of blocks that are allocated on write. Replicated vaults get one copy on each online node. The copy of the first online node doubles as `vault->data`. Mappable vaults are allocated page-wise, so they can be mapped into userspace. Other vaults are served from the spare pools if possible.
+ * @param vault The vault to allocate the storage for.
+ * @param size The size of the storage in bytes.
+ * @return `0` on success, negative value otherwise.
+ */
+static int vault_alloc_data(vault_t *vault, unsigned long size)
+{
+	unsigned long bytes = 0;
+	int node;
+
+	if (vault->flags & VAULT_STRIPED)
+		return vault_alloc_stripes(vault, size);
+
+	if (vault->flags & VAULT_DEDUP)
+		return vault_alloc_blocks(vault, size);
+
+	if (vault->flags & VAULT_MAPPABLE) {
+		vault->data = vmalloc_user(PAGE_ALIGN(size * sizeof(char)));
+		if (vault->data == NULL)
+			return -ENOMEM;
+
+		return vault_account_data(vault, PAGE_ALIGN(size * sizeof(char)));
+	}
+
+	if (!(vault->flags & VAULT_REPLICATED)) {
+		vault->data = spare_claim(size * sizeof(char), &bytes);
+		if (vault->data != NULL)
+			return vault_account_data(vault, bytes);
+
+		vault->data = kzalloc(size * sizeof(char), GFP_KERNEL);
+		if (vault->data == NULL)
+			return -ENOMEM;
+
+		return vault_account_data(vault, size * sizeof(char));
+	}
+
+	vault->replicas = kcalloc(nr_node_ids, sizeof(char *), GFP_KERNEL);
+	vault->node_hits = kcalloc(nr_node_ids, sizeof(atomic_long_t), GFP_KERNEL);
+	if (vault->replicas == NULL || vault->node_hits == NULL)
+		goto err;
+
+	for_each_online_node(node) {
+		vault->replicas[node] = kzalloc_node(size * sizeof(char), GFP_KERNEL, node);
+		if (vault->replicas[node] == NULL)
+			goto err;
+
+		bytes += size * sizeof(char);
+	}
+
+	vault->data = vault->replicas[first_online_node];
+	atomic_long_set(&vault->remote_reads, 0);
+
+	return vault_account_data(vault, bytes);
+
+err:
+	vault_free_data(vault);
+	return -ENOMEM;
+}
+
+/**
+ * @brief Get the copy of the vault data to read from for a node.
+ * @details Replicated vaults serve the copy of the node, and account the read to that node.
+ * @param vault The vault to read from.
+ * @param node The node of the reader.
+ * @return The data to read from.
+ */
+static char *vault_node_data(vault_t *vault, int node)
+{
+	if (vault->replicas == NULL)
+		return vault->data;
+
+	if (vault->replicas[node] == NULL) {
+		atomic_long_inc(&vault->remote_reads);
+		return vault->data;
+	}
+
+	atomic_long_inc(&vault->node_hits[node]);
+
+	return vault->replicas[node];
+}
+
+/**
+ * @brief Get the copy of the vault data to read from for the current CPU.
+ * @param vault The vault to read from.
+ * @return The data to read from.
+ */
+static char *vault_local_data(vault_t *vault)
+{
+	return vault_node_data(vault, numa_node_id());
+}
+
+/**
+ * @brief Store encrypted data in the vault.
+ * @details Replicated vaults apply the data to the copies of all nodes.
+ * @param vault The vault to store the data in.
+ * @param offset The offset in the vault to store the data at.
+ * @param buffer The encrypted data.
+ * @param len The length of the data.
+ */
+static void vault_store(vault_t *vault, loff_t offset, const char *buffer, size_t len)
+{
+	int node;
+
+	if (vault->replicas == NULL) {
+		memcpy(vault->data + offset, buffer, len);
+		return;
+	}
+
+	for_each_node(node) {
+		if (vault->replicas[node] != NULL)
+			memcpy(vault->replicas[node] + offset, buffer, len);
+	}
+}
+
+/**
+ * @brief Set a range of the vault to zero.
+ * @details The stripes of a striped vault must be locked by the caller.
+ * @param vault The vault to clear.
+ * @param offset The offset of the range.
+ * @param len The length of the range.
+ */
+static void vault_clear(vault_t *vault, unsigned long offset, unsigned long len)
+{
+	unsigned long mask = (1UL << vault->stripe_shift) - 1;
+	unsigned long pos, next;
+	int node;
+
+	if (vault->stripes != NULL) {
+		for (pos = offset; pos < offset + len; pos = next) {
+			next = min((pos | mask) + 1, offset + len);
+			memset(vault->stripes[pos >> vault->stripe_shift].data + (pos & mask), 0, next - pos);
+		}
+
+		return;
+	}
+
+	if (vault->replicas == NULL) {
+		memset(vault->data + offset, 0, len);
+		return;
+	}
+
+	for_each_node(node) {
+		if (vault->replicas[node] != NULL)
+			memset(vault->replicas[node] + offset, 0, len);
+	}
+}
+
+/**
+ * @brief Copy encrypted data out of the vault.
+ * @details The caller must hold the lock of the vault, and the stripes of a striped vault. Blocks of a deduplicated vault that were never written read as zero.
+ * @param vault The vault to copy from.
+ * @param offset The offset of the data.
+ * @param buffer The buffer to copy into.
+ * @param len The length of the data.
+ */
+static void vault_load(vault_t *vault, unsigned long offset, char *buffer, unsigned long len)
+{
+	unsigned long mask = (1UL << vault->stripe_shift) - 1;
+	unsigned long pos, next;
+	dedup_block_t *entry;
+
+	if (vault->stripes != NULL) {
+		for (pos = offset; pos < offset + len; pos = next) {
+			next = min((pos | mask) + 1, offset + len);
+			memcpy(buffer + (pos - offset), vault->stripes[pos >> vault->stripe_shift].data + (pos & mask), next - pos);
+		}
+
+		return;
+	}
+
+	if (vault->blocks != NULL) {
+		for (pos = offset; pos < offset + len; pos = next) {
+			next = min(round_down(pos, DEDUP_BLOCK) + DEDUP_BLOCK, offset + len);
+			entry = vault->blocks[pos / DEDUP_BLOCK];
+
+			if (entry != NULL)
+				memcpy(buffer + (pos - offset), entry->data + pos % DEDUP_BLOCK, next - pos);
+			else
+				memset(buffer + (pos - offset), 0, next - pos);
+		}
+
+		return;
+	}
+
+	memcpy(buffer, vault->data + offset, len);
+}
+
+/**
+ * @brief Get the cgroup of the current task.
+ * @return The id of the cgroup on the default hierarchy, `0` without cgroup support.
+ */
+static u64 current_cgroup(void)
+{
+#ifdef CONFIG_CGROUPS
+	u64 id;
+
+	rcu_read_lock();
+	id = cgroup_id(task_dfl_cgroup(current));
+	rcu_read_unlock();
+
+	return id;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * @brief Get the usage entry of a cgroup, adding it if necessary.
+ * @details Once `MAX_CGROUPS` cgroups are tracked, further cgroups share one entry.
+ * @param id The id of the cgroup.
+ * @return The usage entry.
+ */
+static cgroup_usage_t *cgroup_get_usage(u64 id)
+{
+	cgroup_usage_t *usage;
+
+	rcu_read_lock();
+	hash_for_each_possible_rcu(cgroup_usage, usage, node, id) {
+		if (usage->id == id) {
+			rcu_read_unlock();
+			return usage;
+		}
+	}
+	rcu_read_unlock();
+
+	spin_lock(&cgroup_lock);
+
+	hash_for_each_possible(cgroup_usage, usage, node, id) {
+		if (usage->id == id)
+			goto out;
+	}
+
+	usage = NULL;
+
+	if (n_cgroups < MAX_CGROUPS)
+		usage = kzalloc(sizeof(*usage), GFP_ATOMIC);
+
+	if (usage != NULL)
+		usage->time = alloc_percpu_gfp(struct cgroup_time, GFP_ATOMIC);
+
+	if (usage == NULL || usage->time == NULL) {
+		kfree(usage);
+		usage = &cgroup_other;
+		goto out;
+	}
+
+	usage->id = id;
+	hash_add_rcu(cgroup_usage, &usage->node, id);
+	n_cgroups++;
+
+out:
+	spin_unlock(&cgroup_lock);
+
+	return usage;
+}
+
+/**
+ * @brief Charge CPU time to a cgroup.
+ * @param id The id of the cgroup.
+ * @param ns The CPU time in nanoseconds.
+ * @param transform Specifies whether the work was a transform.
+ * @param deferred Specifies whether the work ran on a worker.
+ */
+static void cgroup_charge_ns(u64 id, u64 ns, int transform, int deferred)
+{
+	cgroup_usage_t *usage = cgroup_get_usage(id);
+
+	if (transform)
+		this_cpu_add(usage->time->transform_ns, ns);
+
+	if (deferred)
+		this_cpu_add(usage->time->deferred_ns, ns);
+}
+
+/**
+ * @brief Charge the CPU time since a point in time to a cgroup.
+ * @param id The id of the cgroup.
+ * @param start The start of the work, as returned by `ktime_get_ns()`.
+ * @param transform Specifies whether the work was a transform.
+ * @param deferred Specifies whether the work ran on a worker.
+ */
+static void cgroup_charge(u64 id, u64 start, int transform, int deferred)
+{
+	cgroup_charge_ns(id, ktime_get_ns() - start, transform, deferred);
+}
+
+/**
+ * @brief Sum up the CPU time of a cgroup over all CPUs.
+ * @param usage The usage entry of the cgroup.
+ * @param time The time to fill in.
+ */
+static void cgroup_sum_time(cgroup_usage_t *usage, struct cgroup_time *time)
+{
+	struct cgroup_time *cpu_time;
+	int cpu;
+
+	time->transform_ns = 0;
+	time->deferred_ns = 0;
+
+	for_each_possible_cpu(cpu) {
+		cpu_time = per_cpu_ptr(usage->time, cpu);
+		time->transform_ns += READ_ONCE(cpu_time->transform_ns);
+		time->deferred_ns += READ_ONCE(cpu_time->deferred_ns);
+	}
+}
+
+/**
+ * @brief Free the usage entries of all cgroups.
+ */
+static void cgroup_free_usage(void)
+{
+	cgroup_usage_t *usage;
+	struct hlist_node *tmp;
+	int bkt;
+
+	hash_for_each_safe(cgroup_usage, bkt, tmp, usage, node) {
+		hash_del(&usage->node);
+		free_percpu(usage->time);
+		kfree(usage);
+	}
+}
+
+/**
+ * @brief Clear the erased chunks of the vault that overlap a range.
+ * @details This has to be called before data is stored in the range, so chunks that are still pending never hold data written after the erase.
+ * @param vault The vault to clear.
+ * @param start The start of the range.
+ * @param end The end of the range.
+ */
+static void vault_scrub_range(vault_t *vault, unsigned long start, unsigned long end)
+{
+	unsigned long chunk;
+
+	if (vault->scrub_pending == 0)
+		return;
+
+	for (chunk = start / SCRUB_CHUNK; chunk * SCRUB_CHUNK < end; chunk++) {
+		if (__test_and_clear_bit(chunk, &vault->scrub_pending))
+			vault_clear(vault, chunk * SCRUB_CHUNK, min_t(unsigned long, SCRUB_CHUNK, vault->size - chunk * SCRUB_CHUNK));
+	}
+}
+
+/**
+ * @brief Find a partition of a vault by its name.
+ * @param vault The vault to search.
+ * @param name The name of the partition.
+ * @return The index of the partition, negative value if it does not exist.
+ */
+static int vault_find_partition(vault_t *vault, const char *name)
+{
+	int i;
+
+	for (i = 0; i < MAX_PARTITIONS; i++) {
+		if (vault->parts[i].in_use && strcmp(vault->parts[i].name, name) == 0)
+			return i;
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * @brief Check whether a user owns any partition of a vault.
+ * @param vault The vault to check.
+ * @param uid The user to check.
+ * @return `1` if the user owns a partition, `0` otherwise.
+ */
+static int vault_owns_partition(vault_t *vault, uid_t uid)
+{
+	int i;
+
+	for (i = 0; i < MAX_PARTITIONS; i++) {
+		if (READ_ONCE(vault->parts[i].in_use) && READ_ONCE(vault->parts[i].owner) == uid)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Get a region of a vault on behalf of a user.
+ * @details The caller should hold the lock of the vault, otherwise the region might be stale.
+ * @param vault The vault to access.
+ * @param part_idx The index of the partition, negative value for the whole vault.
+ * @param uid The user accessing the region.
+ * @param region The region to fill in.
+ * @return `0` on success, `-EACCES` if the user does not own the region.
+ */
+static int vault_region(vault_t *vault, int part_idx, uid_t uid, region_t *region)
+{
+	partition_t *part;
+
+	if (part_idx < 0) {
+		if (vault->owner != uid)
+			return -EACCES;
+
+		region->key = vault->key;
+		region->start = 0;
+		region->size = vault->size;
+		region->used_space = &vault->used_space;
+		region->generation = &vault->generation;
+
+		return 0;
+	}
+
+	part = &vault->parts[part_idx];
+
+	if (!part->in_use || part->owner != uid)
+		return -EACCES;
+
+	region->key = part->key;
+	region->start = part->start;
+	region->size = part->size;
+	region->used_space = &part->used_space;
+	region->generation = &part->generation;
+
+	return 0;
+}
+
+/**
+ * @brief Get the index of the partition an opened file selected.
+ * @param file The opened file.
+ * @return The index of the partition, negative value for the whole vault.
+ */
+static int file_partition(struct file *file)
+{
+	return (long)file->private_data - 1;
+}
+
+/**
+ * @brief Reset a vault to default configuration.
+ * @param vault The vault to reset.
+ */
+static void reset_vault(vault_t *vault)
+{
+	int i;
+
+	vault_seq_begin(vault);
+	vault->in_use = 0;
+	vault->size = 0;
+	vault->used_space = 0;
+	vault->owner = -1;
+	vault_seq_end(vault);
+
+	vault_free_data(vault);
+	vault->flags = 0;
+	vault->scrub_pending = 0;
+	vault->queue_head = 0;
+	vault->queue_tail = 0;
+
+	for (i = 0; i < MAX_PARTITIONS; i++) {
+		if (vault->parts[i].in_use) {
+			vault->parts[i].in_use = 0;
+			vault->parts[i].used_space = 0;
+			atomic64_inc(&vault->parts[i].generation);
+		}
+	}
+}
+
+/**
+ * @brief Get the current user id.
+ */
+static uid_t get_current_uid(void)
+{
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(4,14,0)
+	kuid_t uid_wrapper = current_uid();
+	uid_t uid = __kuid_val(uid_wrapper);
+	return uid;
+#else
+	return 1;
+#endif
+}
+
+/**
+ * @brief Encrypt or decrypt a buffer using xor operation.
+ * @details This function is used to encrypt and decrypt the vaults of the module.
+ * @param buffer The buffer to apply this operation on.
+ * @param len The length of the buffer.
+ * @param offset The offset of the encryption cursor in the buffer.
+ * @param key The key to encrypt the buffer with.
+ */
+static void xor_buffer(char *buffer, size_t len, loff_t offset, char key[KEYSIZE])
+{
+	int i, key_idx;
+
+	for (i = 0; i < len; i++) {
+		key_idx = (offset + i) % KEYSIZE;
+		buffer[i] ^= key[key_idx];
+	}
+}
+
+/**
+ * @brief Encrypt or decrypt a buffer into another buffer using xor operation.
+ * @details This saves a separate copy when the source must not be altered.
+ * @param dst The buffer to store the result in.
+ * @param src The buffer to apply this operation on.
+ * @param len The length of the buffers.
+ * @param offset The offset of the encryption cursor in the buffer.
+ * @param key The key to encrypt the buffer with.
+ */
+static void xor_copy(char *dst, const char *src, size_t len, loff_t offset, char key[KEYSIZE])
+{
+	int i, key_idx;
+
+	for (i = 0; i < len; i++) {
+		key_idx = (offset + i) % KEYSIZE;
+		dst[i] = src[i] ^ key[key_idx];
+	}
+}
+
+/**
+ * @brief Compute the checksum of a journal record.
+ * @param header The header of the record.
+ * @param data The data of the record.
+ * @return The checksum.
+ */
+static u32 journal_crc(const journal_header_t *header, const char *data)
+{
+	journal_header_t copy = *header;
+
+	copy.crc = 0;
+
+	return crc32_le(crc32_le(~0, (const u8 *)&copy, sizeof(copy)), (const u8 *)data, header->len);
+}
+
+/**
+ * @brief Write the header of the backing file of a persistent vault and make it durable.
+ * @param vault The persistent vault.
+ * @param used_space The used size of the vault the storage holds.
+ * @param applied The sequence number of the last journal record the storage holds.
+ * @return `0` on success, negative value otherwise.
+ */
+static int persist_write_header(vault_t *vault, u64 used_space, u64 applied)
+{
+	persist_header_t header = {
+		.magic = PERSIST_MAGIC,
+		.size = vault->size,
+		.used_space = used_space,
+		.applied = applied,
+	};
+	loff_t pos = 0;
+
+	header.crc = crc32_le(~0, (const u8 *)&header, sizeof(header));
+
+	if (kernel_write(vault->backing, &header, sizeof(header), &pos) != sizeof(header))
+		return -EIO;
+
+	return vfs_fsync(vault->backing, 1);
+}
+
+/**
+ * @brief Read the header of the backing file of a persistent vault.
+ * @param vault The persistent vault.
+ * @param header The header to fill.
+ * @return `0` if the header is valid, negative value otherwise.
+ */
+static int persist_read_header(vault_t *vault, persist_header_t *header)
+{
+	loff_t pos = 0;
+	u32 crc;
+
+	if (kernel_read(vault->backing, header, sizeof(*header), &pos) != sizeof(*header))
+		return -EIO;
+
+	crc = header->crc;
+	header->crc = 0;
+
+	if (header->magic != PERSIST_MAGIC || crc32_le(~0, (const u8 *)header, sizeof(*header)) != crc)
+		return -EIO;
+
+	return 0;
+}
+
+/**
+ * @brief Apply a journal record to the backing file of a persistent vault.
+ * @details The backing file is not made durable, which is left to the next checkpoint.
+ * @param vault The persistent vault.
+ * @param header The header of the record.
+ * @param data The data of the record.
+ * @return `0` on success, negative value otherwise.
+ */
+static int journal_apply(vault_t *vault, const journal_header_t *header, const char *data)
+{
+	loff_t pos = PERSIST_DATA + header->offset;
+	int ret = 0;
+
+	if (header->type == JOURNAL_WRITE && kernel_write(vault->backing, data, header->len, &pos) != header->len)
+		ret = -EIO;
+
+	// Truncating leaves a hole, which reads as zeros.
+	if (header->type == JOURNAL_ERASE)
+		ret = vfs_truncate(&vault->backing->f_path, PERSIST_DATA);
+
+	if (ret == 0)
+		vault->journal_used = header->used_space;
+
+	return ret;
+}
+
+/**
+ * @brief Make the backing file of a persistent vault durable and restart its journal.
+ * @details The caller must hold the journal mutex of the vault.
+ * @param vault The persistent vault.
+ * @return `0` on success, negative value otherwise.
+ */
+static int journal_checkpoint(vault_t *vault)
+{
+	int ret;
+
+	ret = vfs_fsync(vault->backing, 0);
+	if (ret)
+		return ret;
+
+	ret = persist_write_header(vault, vault->journal_used, vault->journal_committed);
+	if (ret)
+		return ret;
+
+	// Older records left behind in the journal are ignored by their sequence numbers.
+	vault->journal_applied = vault->journal_committed;
+	vault->journal_pos = 0;
+	vault->journal_checkpoints++;
+
+	return 0;
+}
+
+/**
+ * @brief Append a record to the journal of a persistent vault.
+ * @param vault The persistent vault.
+ * @param header The header of the record, whose checksum is set.
+ * @param data The data of the record.
+ * @return `0` on success, negative value otherwise.
+ */
+static int journal_append(vault_t *vault, journal_header_t *header, const char *data)
+{
+	header->crc = journal_crc(header, data);
+
+	if (kernel_write(vault->journal, header, sizeof(*header), &vault->journal_pos) != sizeof(*header))
+		return -EIO;
+
+	if (header->len > 0 && kernel_write(vault->journal, data, header->len, &vault->journal_pos) != header->len)
+		return -EIO;
+
+	return 0;
+}
+
+/**
+ * @brief Rewrite the backing file of a persistent vault from its storage and restart its journal.
+ * @details The caller must hold the journal mutex of the vault. This recovers from a failed commit, after which records may be missing from the journal or a torn record may end it. The storage holds every modification logged so far, so the journal restarts after the last of them. Modifications running meanwhile log later records, which are committed and replayed over the rewritten storage.
+ * @param vault The persistent vault.
+ * @return `0` on success, negative value otherwise.
+ */
+static int journal_rewrite(vault_t *vault)
+{
+	unsigned long used_space;
+	loff_t pos = PERSIST_DATA;
+	u64 seq;
+	int ret;
+
+	// Modifications are applied to the storage before their records get a sequence number.
+	spin_lock(&vault->journal_lock);
+	seq = vault->journal_seq;
+	spin_unlock(&vault->journal_lock);
+
+	used_space = READ_ONCE(vault->used_space);
+
+	// The used space was cleared by the writes that extended it, the rest may still await the scrub.
+	ret = vfs_truncate(&vault->backing->f_path, PERSIST_DATA);
+	if (ret == 0 && kernel_write(vault->backing, vault->data, used_space, &pos) != used_space)
+		ret = -EIO;
+
+	if (ret)
+		return ret;
+
+	vault->journal_used = used_space;
+	vault->journal_committed = seq;
+
+	ret = journal_checkpoint(vault);
+	if (ret)
+		return ret;
+
+	vault->journal_failed = 0;
+
+	return 0;
+}
+
+/**
+ * @brief Commit the pending records of a persistent vault as one group.
+ * @details The records are appended to the journal, followed by a commit record, and the journal is made durable with a single flush. Only then are they applied to the backing file. Requests waiting for durability meanwhile wait for the journal mutex, and find their records committed by the group once they get it. After a failed commit, the backing file is rewritten by `journal_rewrite()` first, and records it already covers are dropped.
+ * @param vault The vault to commit the records of.
+ * @return `0` on success, negative value otherwise.
+ */
+static int journal_commit(vault_t *vault)
+{
+	journal_header_t commit = { .magic = JOURNAL_MAGIC, .type = JOURNAL_COMMIT };
+	journal_rec_t *rec, *next;
+	LIST_HEAD(batch);
+	int ret = 0, n = 0;
+
+	mutex_lock(&vault->journal_mutex);
+
+	if (vault->journal == NULL) {
+		mutex_unlock(&vault->journal_mutex);
+		return 0;
+	}
+
+	spin_lock(&vault->journal_lock);
+	list_splice_init(&vault->journal_pending, &batch);
+	vault->journal_pending_bytes = 0;
+	spin_unlock(&vault->journal_lock);
+
+	if (list_empty(&batch) && !vault->journal_failed) {
+		mutex_unlock(&vault->journal_mutex);
+		return 0;
+	}
+
+	// A failed rewrite covers the records of this batch once it is retried, so they are dropped.
+	if (vault->journal_failed)
+		ret = journal_rewrite(vault);
+
+	list_for_each_entry_safe(rec, next, &batch, node) {
+		if (ret == 0 && rec->header.seq > vault->journal_committed) {
+			ret = journal_append(vault, &rec->header, rec->data);
+
+			commit.seq = rec->header.seq;
+			commit.used_space = rec->header.used_space;
+			vault->journal_records++;
+			n++;
+			continue;
+		}
+
+		list_del(&rec->node);
+		kvfree(rec);
+	}
+
+	if (ret == 0 && n > 0)
+		ret = journal_append(vault, &commit, NULL);
+
+	if (ret == 0 && n > 0)
+		ret = vfs_fsync(vault->journal, 1);
+
+	list_for_each_entry_safe(rec, next, &batch, node) {
+		if (ret == 0)
+			ret = journal_apply(vault, &rec->header, rec->data);
+
+		list_del(&rec->node);
+		kvfree(rec);
+	}
+
+	if (ret == 0 && n > 0) {
+		vault->journal_committed = commit.seq;
+		vault->journal_commits++;
+
+		if (vault->journal_pos >= JOURNAL_CHECKPOINT)
+			ret = journal_checkpoint(vault);
+	}
+
+	if (ret) {
+		printk("Could not commit journal of secvault.\n");
+
+		if (vault->journal_error == 0)
+			vault->journal_error = ret;
+
+		vault->journal_failed = 1;
+	}
+
+	mutex_unlock(&vault->journal_mutex);
+
+	return ret;
+}
+
+/**
+ * @brief Commit the pending records of a persistent vault in the background.
+ * @param work The journal work of the vault.
+ */
+static void journal_flush(struct work_struct *work)
+{
+	vault_t *vault = container_of(work, vault_t, journal_work);
+
+	journal_commit(vault);
+}
+
+/**
+ * @brief Reserve a journal record for a modification of a persistent vault.
+ * @details This is called before the vault is modified, so a modification that cannot be logged fails without changing the vault. If too many records are pending, a request that may wait commits them first.
+ * @param vault The vault to modify.
+ * @param len The maximum length of the modified range.
+ * @param nowait Specifies whether the request must not wait.
+ * @return The record, `NULL` if the vault is not persistent, `ERR_PTR(-EBUSY)` if `nowait` is set and the request would wait, other error pointer on failure.
+ */
+static journal_rec_t *journal_alloc(vault_t *vault, size_t len, int nowait)
+{
+	journal_rec_t *rec;
+
+	if (READ_ONCE(vault->journal) == NULL)
+		return NULL;
+
+	if (READ_ONCE(vault->journal_pending_bytes) > JOURNAL_PENDING_MAX) {
+		if (nowait)
+			return ERR_PTR(-EBUSY);
+
+		journal_commit(vault);
+	}
+
+	if (nowait)
+		rec = kmalloc(sizeof(*rec) + len, GFP_NOWAIT | __GFP_NOWARN);
+	else
+		rec = kvmalloc(sizeof(*rec) + len, GFP_KERNEL);
+
+	if (rec == NULL && nowait)
+		return ERR_PTR(-EBUSY);
+
+	if (rec == NULL) {
+		printk("Could not allocate memory to journal secvault.\n");
+		return ERR_PTR(-ENOMEM);
+	}
+
+	return rec;
+}
+
+/**
+ * @brief Log a modification of a persistent vault.
+ * @details The caller must hold the lock of the vault and have applied the modification. The encrypted data of the range is copied into the record reserved by `journal_alloc()`, which is committed in the background together with the records of other requests. This never waits. A vault that became persistent after the reservation is rewritten completely when it is deleted.
+ * @param vault The vault that was modified.
+ * @param rec The reserved record, consumed by this function, may be `NULL`.
+ * @param type The type of the modification.
+ * @param offset The offset of the modified range.
+ * @param len The length of the modified range, at most the reserved length.
+ */
+static void journal_log(vault_t *vault, journal_rec_t *rec, enum journal_type type, loff_t offset, size_t len)
+{
+	int kick;
+
+	if (vault->journal == NULL) {
+		kvfree(rec);
+		return;
+	}
+
+	if (rec == NULL) {
+		WRITE_ONCE(vault->journal_failed, 1);
+		return;
+	}
+
+	rec->header = (journal_header_t) {
+		.magic = JOURNAL_MAGIC,
+		.type = type,
+		.offset = offset,
+		.len = len,
+		.used_space = vault->used_space,
+	};
+	memcpy(rec->data, vault->data + offset, len);
+
+	spin_lock(&vault->journal_lock);
+	rec->header.seq = ++vault->journal_seq;
+	kick = list_empty(&vault->journal_pending);
+	list_add_tail(&rec->node, &vault->journal_pending);
+	vault->journal_pending_bytes += sizeof(rec->header) + len;
+	spin_unlock(&vault->journal_lock);
+
+	if (kick)
+		queue_work(class_wq[CLASS_BULK], &vault->journal_work);
+}
+
+/**
+ * @brief Read the next record of the journal of a persistent vault.
+ * @param vault The persistent vault.
+ * @param pos The position of the record, advanced past it.
+ * @param header The header to fill.
+ * @param data The buffer for the data, of `MAX_DATA` bytes.
+ * @return `0` if the record is intact, negative value otherwise.
+ */
+static int journal_read(vault_t *vault, loff_t *pos, journal_header_t *header, char *data)
+{
+	if (kernel_read(vault->journal, header, sizeof(*header), pos) != sizeof(*header))
+		return -EIO;
+
+	if (header->magic != JOURNAL_MAGIC || header->len > MAX_DATA)
+		return -EIO;
+
+	if (header->len > 0 && kernel_read(vault->journal, data, header->len, pos) != header->len)
+		return -EIO;
+
+	if (journal_crc(header, data) != header->crc)
+		return -EIO;
+
+	return 0;
+}
+
+/**
+ * @brief Apply the committed records of the journal of a persistent vault to its backing file.
+ * @details Records are only applied if they continue the sequence after the last checkpoint and belong to a group that was committed completely, so a torn group commit is discarded as a whole. The backing file is then made durable.
+ * @param vault The persistent vault.
+ * @param header The header of the backing file, updated to the applied records.
+ * @return `0` on success, negative value otherwise.
+ */
+static int journal_replay(vault_t *vault, persist_header_t *header)
+{
+	journal_header_t rec;
+	loff_t pos = 0, end = 0;
+	u64 expect = header->applied + 1;
+	u64 last = header->applied;
+	char *data;
+	int ret = 0;
+
+	data = kvmalloc(MAX_DATA, GFP_KERNEL);
+	if (data == NULL)
+		return -ENOMEM;
+
+	while (journal_read(vault, &pos, &rec, data) == 0) {
+		if (rec.type == JOURNAL_COMMIT) {
+			if (rec.seq != expect - 1 || rec.seq == last)
+				break;
+
+			end = pos;
+			last = rec.seq;
+			continue;
+		}
+
+		if (rec.seq != expect || rec.offset + rec.len > header->size || rec.used_space > header->size)
+			break;
+
+		expect++;
+	}
+
+	vault->journal_used = header->used_space;
+
+	for (pos = 0; pos < end && ret == 0; ) {
+		ret = journal_read(vault, &pos, &rec, data);
+
+		if (ret == 0 && rec.type != JOURNAL_COMMIT)
+			ret = journal_apply(vault, &rec, data);
+	}
+
+	kvfree(data);
+
+	if (ret == 0 && last != header->applied) {
+		ret = vfs_fsync(vault->backing, 0);
+
+		if (ret == 0)
+			ret = persist_write_header(vault, vault->journal_used, last);
+	}
+
+	if (ret)
+		return ret;
+
+	header->used_space = vault->journal_used;
+	header->applied = last;
+
+	return 0;
+}
+
+/**
+ * @brief Open a file of a persistent vault in `persist_dir`.
+ * @param id The id of the vault.
+ * @param suffix The suffix of the file name.
+ * @return The opened file, or an error pointer.
+ */
+static struct file *persist_open_file(unsigned int id, const char *suffix)
+{
+	struct file *file;
+	char *path;
+
+	path = kasprintf(GFP_KERNEL, "%s/vault%u%s", persist_dir, id, suffix);
+	if (path == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	file = filp_open(path, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+	kfree(path);
+
+	return file;
+}
+
+/**
+ * @brief Close the files of a persistent vault.
+ * @param vault The persistent vault.
+ */
+static void persist_close_files(vault_t *vault)
+{
+	if (vault->journal != NULL)
+		filp_close(vault->journal, NULL);
+
+	if (vault->backing != NULL)
+		filp_close(vault->backing, NULL);
+
+	vault->journal = NULL;
+	vault->backing = NULL;
+}
+
+/**
+ * @brief Open the backing file and journal of a persistent vault and recover its storage.
+ * @details The caller must hold the lock of the vault, whose size is set and whose storage is allocated and zeroed. Missing files are created; otherwise the committed records of the journal are applied to the backing file first, and its content is loaded into the storage. The files are opened with the credentials of the caller.
+ * @param vault The vault to open the files of.
+ * @param id The id of the vault.
+ * @param used_space The used size of the recovered vault, set on success.
+ * @return `0` on success, `-EINVAL` if the backing file holds a vault of another size, other negative value otherwise.
+ */
+static int persist_open(vault_t *vault, unsigned int id, unsigned long *used_space)
+{
+	persist_header_t header;
+	loff_t pos = PERSIST_DATA;
+	ssize_t n;
+	int ret;
+
+	vault->backing = persist_open_file(id, "");
+	vault->journal = persist_open_file(id, ".journal");
+
+	if (IS_ERR(vault->backing) || IS_ERR(vault->journal)) {
+		ret = IS_ERR(vault->backing) ? PTR_ERR(vault->backing) : PTR_ERR(vault->journal);
+
+		if (IS_ERR(vault->backing))
+			vault->backing = NULL;
+
+		if (IS_ERR(vault->journal))
+			vault->journal = NULL;
+
+		persist_close_files(vault);
+
+		return ret;
+	}
+
+	vault->journal_pos = 0;
+	vault->journal_error = 0;
+	vault->journal_failed = 0;
+
+	if (i_size_read(file_inode(vault->backing)) == 0) {
+		// A stale journal would otherwise continue the sequence of the new backing file.
+		ret = vfs_truncate(&vault->journal->f_path, 0);
+		if (ret == 0)
+			ret = vfs_fsync(vault->journal, 1);
+
+		if (ret == 0)
+			ret = persist_write_header(vault, 0, 0);
+
+		if (ret == 0)
+			ret = vfs_truncate(&vault->backing->f_path, PERSIST_DATA);
+
+		header.used_space = 0;
+		header.applied = 0;
+	} else {
+		ret = persist_read_header(vault, &header);
+
+		if (ret == 0 && header.size != vault->size) {
+			printk("Persisted secvault has a different size.\n");
+			ret = -EINVAL;
+		}
+
+		if (ret == 0)
+			ret = journal_replay(vault, &header);
+
+		if (ret == 0) {
+			n = kernel_read(vault->backing, vault->data, vault->size, &pos);
+			if (n < 0)
+				ret = n;
+		}
+	}
+
+	if (ret) {
+		persist_close_files(vault);
+		return ret;
+	}
+
+	vault->journal_seq = header.applied;
+	vault->journal_committed = header.applied;
+	vault->journal_applied = header.applied;
+	vault->journal_used = header.used_space;
+	*used_space = min_t(u64, header.used_space, vault->size);
+
+	return 0;
+}
+
+/**
+ * @brief Commit the journal of a persistent vault, make its backing file durable and close its files.
+ * @details The caller must hold the lock of the vault. If a commit failed before and the backing file could not be rewritten since, it is rewritten once more. Nothing happens for vaults that are not persistent.
+ * @param vault The vault to close the files of.
+ * @return `0` on success, negative value otherwise.
+ */
+static int persist_close(vault_t *vault)
+{
+	int ret;
+
+	if (vault->journal == NULL)
+		return 0;
+
+	cancel_work_sync(&vault->journal_work);
+	journal_commit(vault);
+
+	mutex_lock(&vault->journal_mutex);
+
+	if (vault->journal_failed)
+		ret = journal_rewrite(vault);
+	else
+		ret = journal_checkpoint(vault);
+
+	if (ret)
+		printk("Could not persist secvault.\n");
+
+	persist_close_files(vault);
+	vault->journal_commits = 0;
+	vault->journal_records = 0;
+	vault->journal_checkpoints = 0;
+
+	mutex_unlock(&vault->journal_mutex);
+
+	return ret;
+}
+
+/**
+ * @brief Resolve the region of a pending request and clamp it to the region.
+ * @details Reads copy the encrypted data into the buffer of the request, from the copy of the node of the submitter rather than the one of the executing CPU.
+ * @param vault The vault the request belongs to.
+ * @param op The request to prepare.
+ * @return `0` if the request has data to transform, `1` if it is complete.
+ */
+static int combine_prepare(vault_t *vault, combine_op_t *op)
+{
+	region_t region;
+	unsigned long limit;
+
+	if (vault_region(vault, op->part_idx, op->uid, &region)) {
+		op->result = -EACCES;
+		return 1;
+	}
+
+	if (vault->stripes != NULL || vault->blocks != NULL || (vault->flags & VAULT_QUEUE)) {
+		op->result = -EINVAL;
+		return 1;
+	}
+
+	limit = op->write ? region.size : *region.used_space;
+
+	if (op->offset >= limit) {
+		op->result = 0;
+		return 1;
+	}
+
+	if (limit - op->offset < op->len)
+		op->len = limit - op->offset;
+
+	op->key = region.key;
+	op->start = region.start;
+	op->result = op->len;
+
+	if (!op->write)
+		memcpy(op->buffer, vault_node_data(vault, op->numa) + region.start + op->offset, op->len);
+
+	return 0;
+}
+
+/**
+ * @brief Store a prepared write and update its region.
+ * @param vault The vault the request belongs to.
+ * @param op The request to commit.
+ */
+static void combine_commit(vault_t *vault, combine_op_t *op)
+{
+	region_t region;
+
+	// The region was resolved by combine_prepare() under the same lock.
+	vault_region(vault, op->part_idx, op->uid, &region);
+
+	vault_seq_begin(vault);
+
+	if (op->offset + op->len > *region.used_space)
+		*region.used_space = op->offset + op->len;
+
+	vault_scrub_range(vault, op->start, op->start + op->offset + op->len);
+	vault_store(vault, op->start + op->offset, op->buffer, op->len);
+	vault_seq_end(vault);
+
+	journal_log(vault, op->rec, JOURNAL_WRITE, op->start + op->offset, op->len);
+	op->rec = NULL;
+	atomic64_inc(region.generation);
+}
+
+/**
+ * @brief Transform the data of several prepared requests in one pass.
+ * @details The time of the pass is charged to the cgroups of the requests in proportion to their length.
+ * @param lanes The data of the requests.
+ * @param ops The requests.
+ * @param n The number of requests, at most `TRANSFORM_LANES`.
+ */
+static void combine_transform(struct transform_lane *lanes, combine_op_t **ops, unsigned int n)
+{
+	u64 start, ns, total = 0;
+	unsigned int i;
+
+	start = ktime_get_ns();
+	transform_lanes(lanes, n);
+	ns = ktime_get_ns() - start;
+
+	for (i = 0; i < n; i++)
+		total += ops[i]->len;
+
+	for (i = 0; i < n; i++)
+		cgroup_charge_ns(ops[i]->cgroup, total ? div64_u64(ns * ops[i]->len, total) : 0, 1, 0);
+}
+
+/**
+ * @brief Execute all pending small requests of a vault.
+ * @details The caller must hold the lock of the vault. The requests are executed in the order they were submitted: all regions are resolved first, then the data of the batch is transformed `TRANSFORM_LANES` requests at a time, and finally writes are stored and all submitters are woken up.
+ * @param vault The vault to execute the requests of.
+ */
+static void vault_combine(vault_t *vault)
+{
+	struct transform_lane lanes[TRANSFORM_LANES];
+	combine_op_t *lane_ops[TRANSFORM_LANES];
+	struct llist_node *batch;
+	combine_op_t *op, *next;
+	unsigned int n = 0;
+
+	batch = llist_del_all(&vault->pending);
+	if (batch == NULL)
+		return;
+
+	batch = llist_reverse_order(batch);
+
+	llist_for_each_entry(op, batch, node)
+		op->skip = combine_prepare(vault, op);
+
+	llist_for_each_entry(op, batch, node) {
+		if (op->skip)
+			continue;
+
+		lanes[n].buffer = op->buffer;
+		lanes[n].len = op->len;
+		lanes[n].offset = op->offset;
+		lanes[n].key = op->key;
+		lane_ops[n++] = op;
+
+		if (n == TRANSFORM_LANES) {
+			combine_transform(lanes, lane_ops, n);
+			n = 0;
+		}
+	}
+
+	if (n > 0)
+		combine_transform(lanes, lane_ops, n);
+
+	// The submitter may return as soon as its request is done, so the list is walked with lookahead.
+	llist_for_each_entry_safe(op, next, batch, node) {
+		if (op->write && !op->skip)
+			combine_commit(vault, op);
+
+		vault->combined++;
+		smp_store_release(&op->done, 1);
+	}
+
+	vault->batches++;
+	wake_up_all(&vault->combine_wait);
+}
+
+/**
+ * @brief Take the lock of a vault.
+ * @param vault The vault to lock.
+ */
+static void vault_lock(vault_t *vault)
+{
+	down(&vault->sem);
+	WRITE_ONCE(vault->locked, 1);
+}
+
+/**
+ * @brief Take the lock of a vault unless interrupted.
+ * @param vault The vault to lock.
+ * @return `0` on success, `-EINTR` if interrupted.
+ */
+static int vault_lock_interruptible(vault_t *vault)
+{
+	int ret = down_interruptible(&vault->sem);
+
+	if (ret == 0)
+		WRITE_ONCE(vault->locked, 1);
+
+	return ret;
+}
+
+/**
+ * @brief Take the lock of a vault if it is free.
+ * @param vault The vault to lock.
+ * @return `0` on success, `1` if the lock is held.
+ */
+static int vault_trylock(vault_t *vault)
+{
+	if (down_trylock(&vault->sem))
+		return 1;
+
+	WRITE_ONCE(vault->locked, 1);
+
+	return 0;
+}
+
+/**
+ * @brief Release the lock of a vault.
+ * @details Small requests that were queued while the lock was held are executed before the lock is released. If new requests arrive after the release, they are picked up by retaking the lock, unless another thread already holds it and will do so itself.
+ * @param vault The vault to unlock.
+ */
+static void vault_unlock(vault_t *vault)
+{
+	do {
+		vault_combine(vault);
+		WRITE_ONCE(vault->locked, 0);
+		up(&vault->sem);
+	} while (!llist_empty(&vault->pending) && !vault_trylock(vault));
+
+	if (wq_has_sleeper(&vault->poll_wait))
+		wake_up_interruptible_poll(&vault->poll_wait, EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM);
+}
+
+/**
+ * @brief Submit a small request and wait until it was executed.
+ * @details If the lock of the vault is free, the submitter executes its own request along with all others that are pending. Otherwise it sleeps until the holder of the lock executes it. The wait cannot be interrupted, as the request lives on the stack of the submitter. Non-blocking requests are only queued once the submitter holds the lock, so they never wait for another holder.
+ * @param vault The vault to access.
+ * @param op The request to execute.
+ * @param nowait Specifies whether the request must not wait for the lock.
+ * @return `0` once the request was executed, `-EBUSY` if `nowait` is set and the lock is held.
+ */
+static int vault_submit(vault_t *vault, combine_op_t *op, int nowait)
+{
+	op->done = 0;
+
+	if (nowait) {
+		if (vault_trylock(vault))
+			return -EBUSY;
+
+		llist_add(&op->node, &vault->pending);
+		vault_unlock(vault);
+
+		return 0;
+	}
+
+	atomic_inc(&vault->foreground);
+	llist_add(&op->node, &vault->pending);
+
+	if (!vault_trylock(vault))
+		vault_unlock(vault);
+
+	wait_event(vault->combine_wait, smp_load_acquire(&op->done));
+	atomic_dec(&vault->foreground);
+
+	return 0;
+}
+
+/**
+ * @brief Take the lock of a vault for a foreground request.
+ * @details Background work holding the lock sees the waiting request and yields.
+ * @param vault The vault to lock.
+ * @return `0` on success, non-zero value if interrupted.
+ */
+static int vault_lock_foreground(vault_t *vault)
+{
+	int ret;
+
+	atomic_inc(&vault->foreground);
+	ret = vault_lock_interruptible(vault);
+	atomic_dec(&vault->foreground);
+
+	return ret;
+}
+
+/**
+ * @brief Get the allocation flags of a request.
+ * @details Non-blocking requests must not enter reclaim, so their allocations fail instead.
+ * @param nowait Specifies whether the request must not wait.
+ * @return The allocation flags.
+ */
+static gfp_t request_gfp(int nowait)
+{
+	return nowait ? GFP_NOWAIT | __GFP_NOWARN : GFP_KERNEL;
+}
+
+/**
+ * @brief Start the latency measurement of a read or write.
+ * @details Only every `latency_sample`-th request of a CPU is measured, the others only pay for the counter.
+ * @param lat The measurement to start.
+ * @param file The file the request accesses.
+ * @param write Specifies whether the request is a write.
+ */
+static void latency_begin(latency_t *lat, struct file *file, int write)
+{
+	unsigned int n = READ_ONCE(latency_sample);
+
+	lat->active = 0;
+
+	if (n == 0 || this_cpu_inc_return(latency_tick) % n != 0)
+		return;
+
+	memset(lat, 0, sizeof(*lat));
+	lat->vault = &vaults[MINOR(file->f_inode->i_rdev)];
+	lat->write = write;
+	lat->active = 1;
+	lat->start = ktime_get_ns();
+	lat->last = lat->start;
+}
+
+/**
+ * @brief End a phase of a measured request.
+ * @details The time since the previous phase ended is attributed to the phase.
+ * @param lat The measurement of the request, may be `NULL`.
+ * @param phase The phase that ended.
+ */
+static void latency_mark(latency_t *lat, enum latency_phase phase)
+{
+	u64 now;
+
+	if (lat == NULL || !lat->active)
+		return;
+
+	now = ktime_get_ns();
+	lat->ns[phase] += now - lat->last;
+	lat->seen |= 1U << phase;
+	lat->last = now;
+}
+
+/**
+ * @brief Discard the time since the previous phase of a measured request ended.
+ * @param lat The measurement of the request, may be `NULL`.
+ */
+static void latency_skip(latency_t *lat)
+{
+	if (lat != NULL && lat->active)
+		lat->last = ktime_get_ns();
+}
+
+/**
+ * @brief Count a duration in a latency histogram of a vault.
+ * @param vault The vault of the histogram.
+ * @param write Specifies whether the histogram is the one of writes.
+ * @param phase The phase of the histogram.
+ * @param ns The duration in nanoseconds.
+ */
+static void latency_record(vault_t *vault, int write, enum latency_phase phase, u64 ns)
+{
+	unsigned int bucket = min_t(unsigned int, fls64(ns), LATENCY_BUCKETS - 1);
+
+	atomic_long_inc(&vault->latency[write][phase][bucket]);
+}
+
+/**
+ * @brief End the latency measurement of a read or write.
+ * @details The phases the request passed through and its total time are counted in the histograms of the vault.
+ * @param lat The measurement to end.
+ */
+static void latency_end(latency_t *lat)
+{
+	enum latency_phase phase;
+
+	if (!lat->active)
+		return;
+
+	for (phase = 0; phase < PHASE_TOTAL; phase++) {
+		if (lat->seen & (1U << phase))
+			latency_record(lat->vault, lat->write, phase, lat->ns[phase]);
+	}
+
+	latency_record(lat->vault, lat->write, PHASE_TOTAL, ktime_get_ns() - lat->start);
+}
+
+/**
+ * @brief Get the priority class of work done on behalf of the current task.
+ * @details Tasks with raised priority get interactive workers, all others bulk workers.
+ * @return The priority class.
+ */
+static enum vault_class current_class(void)
+{
+	return task_nice(current) < 0 ? CLASS_INTERACTIVE : CLASS_BULK;
+}
+
+/**
+ * @brief Clear the erased storage of a vault in the background.
+ * @details The storage is cleared chunk by chunk. Whenever a foreground request waits for the vault, the lock is released and the work is requeued after `SCRUB_BACKOFF`. The pace is set by the governor.
+ * @param work The work item of the vault.
+ */
+static void vault_scrub(struct work_struct *work)
+{
+	vault_t *vault = container_of(to_delayed_work(work), vault_t, scrub_work);
+	unsigned long chunk;
+	int steps = 0;
+	u64 start;
+
+	vault_lock(vault);
+
+	while (vault->scrub_pending != 0) {
+		if (atomic_read(&vault->foreground) > 0) {
+			vault->scrub_yields++;
+			vault_unlock(vault);
+			queue_delayed_work(class_wq[CLASS_BACKGROUND], &vault->scrub_work, SCRUB_BACKOFF);
+			return;
+		}
+
+		// Vaults with foreground traffic get one chunk per interval unless the system is idle.
+		if (!governor_allow() || (steps > 0 && governor_busy(vault) && !READ_ONCE(governor.accelerated))) {
+			vault_unlock(vault);
+			queue_delayed_work(class_wq[CLASS_BACKGROUND], &vault->scrub_work, GOV_INTERVAL);
+			return;
+		}
+
+		chunk = __ffs(vault->scrub_pending);
+
+		start = ktime_get_ns();
+		vault_seq_begin(vault);
+		vault_scrub_range(vault, chunk * SCRUB_CHUNK, chunk * SCRUB_CHUNK + 1);
+		vault_seq_end(vault);
+		cgroup_charge(vault->scrub_cgroup, start, 0, 1);
+		governor_charge(start);
+
+		steps++;
+	}
+
+	vault_unlock(vault);
+}
+
+/**
+ * @brief Erase the storage of a vault.
+ * @details The caller must hold the lock of the vault. The storage is cleared by background work, writes clear the chunks they touch first. Mapped vaults are cleared right away, as the mapping exposes the storage directly, and so are striped vaults, whose stripes the caller has to lock. Deduplicated vaults drop their blocks. Queue vaults drop their messages, the caller has to lock the queue.
+ * @param vault The vault to erase.
+ */
+static void vault_erase_data(vault_t *vault)
+{
+	if (vault->blocks != NULL) {
+		dedup_drop_all(vault);
+		return;
+	}
+
+	if (vault->flags & VAULT_QUEUE) {
+		vault_clear(vault, 0, vault->size);
+		vault->queue_head = 0;
+		vault->queue_tail = 0;
+		return;
+	}
+
+	if (atomic_read(&vault->mappings) > 0 || vault->stripes != NULL) {
+		vault_clear(vault, 0, vault->size);
+		return;
+	}
+
+	vault->scrub_pending = BIT(DIV_ROUND_UP(vault->size, SCRUB_CHUNK)) - 1;
+	vault->scrub_cgroup = current_cgroup();
+	queue_delayed_work(class_wq[CLASS_BACKGROUND], &vault->scrub_work, 0);
+	governor_kick();
+}
+
+/**
+ * @brief Lock all stripes of a vault.
+ * @details Nothing happens for vaults that are not striped. The stripes are always locked in ascending order.
+ * @param vault The vault to lock the stripes of.
+ */
+static void stripe_lock_all(vault_t *vault)
+{
+	int i;
+
+	for (i = 0; i < vault->n_stripes; i++)
+		down(&vault->stripes[i].sem);
+}
+
+/**
+ * @brief Unlock all stripes of a vault.
+ * @param vault The vault to unlock the stripes of.
+ */
+static void stripe_unlock_all(vault_t *vault)
+{
+	int i;
+
+	for (i = 0; i < vault->n_stripes; i++)
+		up(&vault->stripes[i].sem);
+}
+
+/**
+ * @brief Lock the producers and consumers of a queue vault.
+ * @details Nothing happens for other vaults. The caller must hold the lock of the vault, which is always taken first.
+ * @param vault The vault to lock the queue of.
+ */
+static void queue_lock_all(vault_t *vault)
+{
+	if (!(vault->flags & VAULT_QUEUE))
+		return;
+
+	down(&vault->queue_produce);
+	down(&vault->queue_consume);
+}
+
+/**
+ * @brief Unlock the producers and consumers of a queue vault.
+ * @param vault The vault to unlock the queue of.
+ */
+static void queue_unlock_all(vault_t *vault)
+{
+	if (!(vault->flags & VAULT_QUEUE))
+		return;
+
+	up(&vault->queue_consume);
+	up(&vault->queue_produce);
+}
+
+/**
+ * @brief Start a request on the stripes of a vault.
+ * @details The vault is checked while its sequence counter is stable, so the lock of the vault is not needed. The stripes are not freed before the request ends with `stripe_put()`.
+ * @param vault The vault to access.
+ * @param uid The user accessing the vault.
+ * @return `0` on success, `-EAGAIN` if the vault is not striped, `-EACCES` if the user does not own it.
+ */
+static int stripe_get(vault_t *vault, uid_t uid)
+{
+	unsigned int seq;
+	int ret;
+
+	for (;;) {
+		seq = vault_seq_wait(vault);
+
+		rcu_read_lock();
+
+		if (!READ_ONCE(vault->in_use) || READ_ONCE(vault->stripes) == NULL)
+			ret = -EAGAIN;
+		else if (READ_ONCE(vault->owner) != uid)
+			ret = -EACCES;
+		else
+			ret = 0;
+
+		if (ret == 0)
+			atomic_inc(&vault->stripe_users);
+
+		if (!read_seqcount_retry(&vault->seq, seq)) {
+			rcu_read_unlock();
+			return ret;
+		}
+
+		if (ret == 0 && atomic_dec_and_test(&vault->stripe_users))
+			wake_up_all(&vault->stripe_wait);
+
+		rcu_read_unlock();
+	}
+}
+
+/**
+ * @brief End a request on the stripes of a vault.
+ * @param vault The accessed vault.
+ */
+static void stripe_put(vault_t *vault)
+{
+	if (atomic_dec_and_test(&vault->stripe_users))
+		wake_up_all(&vault->stripe_wait);
+}
+
+/**
+ * @brief Struct of the part of a request that falls into one stripe.
+ */
+struct stripe_work {
+	struct work_struct work; ///< The work item to process the part on a worker.
+	vault_t *vault; ///< The vault to access.
+	char *buffer; ///< The plaintext of the part.
+	unsigned long offset; ///< The offset of the part in the vault.
+	unsigned long len; ///< The length of the part.
+	int write; ///< Specifies whether the part is written.
+	u64 cgroup; ///< The cgroup of the task that issued the request.
+	int deferred; ///< Specifies whether the part is processed on a worker.
+	int nowait; ///< Specifies whether the part must not wait for the lock of its stripe.
+	int busy; ///< Specifies whether the part was skipped, as the lock of its stripe was held.
+};
+
+/**
+ * @brief Encrypt a part of a request into its stripe, or decrypt it from there.
+ * @details A written part extends the used space of the vault while the lock of its stripe is held, so it cannot race with an erase, which holds the locks of all stripes.
+ * @param work The work item of the part.
+ */
+static void stripe_io_one(struct work_struct *work)
+{
+	struct stripe_work *sw = container_of(work, struct stripe_work, work);
+	vault_t *vault = sw->vault;
+	stripe_t *stripe = &vault->stripes[sw->offset >> vault->stripe_shift];
+	char *data = stripe->data + (sw->offset & ((1UL << vault->stripe_shift) - 1));
+	unsigned long end = sw->offset + sw->len, old, prev;
+	u64 start;
+
+	if (!sw->nowait) {
+		down(&stripe->sem);
+	} else if (down_trylock(&stripe->sem)) {
+		sw->busy = 1;
+		return;
+	}
+
+	start = ktime_get_ns();
+
+	if (sw->write)
+		xor_copy(data, sw->buffer, sw->len, sw->offset, vault->key);
+	else
+		xor_copy(sw->buffer, data, sw->len, sw->offset, vault->key);
+
+	cgroup_charge(sw->cgroup, start, 1, sw->deferred);
+
+	if (sw->write) {
+		// Parts on other stripes update the used space concurrently.
+		old = READ_ONCE(vault->used_space);
+		while (old < end) {
+			prev = cmpxchg(&vault->used_space, old, end);
+			if (prev == old)
+				break;
+
+			old = prev;
+		}
+	}
+
+	up(&stripe->sem);
+}
+
+/**
+ * @brief Read from or write into a striped vault.
+ * @details The request is split at the stripe boundaries, and each part only locks its own stripe. Large requests spanning several stripes are processed on workers in parallel. The data passes through a kernel buffer, so workers do not access userspace. Non-blocking requests process their parts in order on the calling thread, and end at the first stripe whose lock is held.
+ * @param vault The vault to access.
+ * @param user The buffer in userspace.
+ * @param len The length of the buffer.
+ * @param offset The offset in the vault.
+ * @param write Specifies whether the request is a write.
+ * @param nowait Specifies whether the request must not wait.
+ * @return Size of the data read or written, negative value on error, `-EAGAIN` if the vault is not striped, `-EBUSY` if `nowait` is set and nothing could be done without waiting.
+ */
+static ssize_t vault_io_striped(vault_t *vault, void __user *user, size_t len, loff_t *offset, int write, int nowait)
+{
+	struct stripe_work *works = NULL;
+	struct stripe_work single;
+	unsigned long stripe_size, limit, pos, end;
+	size_t to_copy, alloc_len, not_copied = 0;
+	enum vault_class class;
+	char *buffer;
+	ssize_t ret;
+	int i, n, busy = 0;
+
+	ret = stripe_get(vault, get_current_uid());
+	if (ret)
+		return ret;
+
+	limit = write ? vault->size : READ_ONCE(vault->used_space);
+
+	if (*offset >= limit) {
+		ret = 0;
+		goto out;
+	}
+
+	to_copy = alloc_len = min_t(size_t, len, limit - *offset);
+
+	buffer = kvmalloc(alloc_len, request_gfp(nowait));
+	if (buffer == NULL) {
+		ret = nowait ? -EBUSY : -ENOMEM;
+		goto out;
+	}
+
+	if (write) {
+		not_copied = copy_from_user(buffer, user, to_copy);
+		to_copy -= not_copied;
+	}
+
+	stripe_size = 1UL << vault->stripe_shift;
+	end = *offset + to_copy;
+	n = to_copy > 0 ? ((end - 1) >> vault->stripe_shift) - (*offset >> vault->stripe_shift) + 1 : 0;
+
+	if (n > 1 && to_copy >= STRIPE_PARALLEL_MIN && !nowait)
+		works = kcalloc(n, sizeof(*works), GFP_KERNEL);
+
+	class = current_class();
+
+	for (i = 0, pos = *offset; pos < end; i++, pos = min((pos | (stripe_size - 1)) + 1, end)) {
+		struct stripe_work *sw = works != NULL ? &works[i] : &single;
+
+		sw->vault = vault;
+		sw->buffer = buffer + (pos - *offset);
+		sw->offset = pos;
+		sw->len = min((pos | (stripe_size - 1)) + 1, end) - pos;
+		sw->write = write;
+		sw->cgroup = current_cgroup();
+		sw->deferred = works != NULL;
+		sw->nowait = nowait;
+		sw->busy = 0;
+		INIT_WORK(&sw->work, stripe_io_one);
+
+		if (works != NULL) {
+			queue_work(class_wq[class], &sw->work);
+			continue;
+		}
+
+		stripe_io_one(&sw->work);
+
+		// Only the parts before the first busy stripe are done.
+		if (sw->busy) {
+			busy = 1;
+			to_copy = pos - *offset;
+			end = pos;
+			break;
+		}
+	}
+
+	if (works != NULL) {
+		for (i = 0; i < n; i++)
+			flush_work(&works[i].work);
+
+		kfree(works);
+	}
+
+	if (write) {
+		if (to_copy > 0)
+			atomic64_inc(&vault->generation);
+	} else {
+		not_copied = copy_to_user(user, buffer, to_copy);
+		to_copy -= not_copied;
+	}
+
+	kvfree_sensitive(buffer, alloc_len);
+
+	*offset += to_copy;
+	ret = busy && to_copy == 0 ? -EBUSY : to_copy;
+
+out:
+	stripe_put(vault);
+
+	return ret;
+}
+
+/**
+ * @brief Store a block into a deduplicated vault.
+ * @details If an identical block is stored already, it is shared. Otherwise the block is written in place if no other block shares its storage, or copied into a new block. The caller must hold the lock of the vault.
+ * @param vault The vault to store the block in.
+ * @param idx The index of the block in the vault.
+ * @param block The plaintext of the whole block, which is encrypted in place.
+ * @param gfp The allocation flags of a new block.
+ * @return `0` on success, negative value otherwise.
+ */
+static int dedup_store(vault_t *vault, unsigned long idx, char *block, gfp_t gfp)
+{
+	dedup_block_t *old = vault->blocks[idx];
+	dedup_block_t *entry;
+	struct hlist_head *bucket;
+	u64 hash;
+
+	hash = siphash(block, DEDUP_BLOCK, &vault->dedup_key);
+	bucket = &vault->dedup_table[hash & ((1UL << vault->dedup_bits) - 1)];
+
+	xor_buffer(block, DEDUP_BLOCK, 0, vault->key);
+
+	// The hash only finds candidates, equal blocks are confirmed by their content.
+	hlist_for_each_entry(entry, bucket, node) {
+		if (entry->hash != hash || memcmp(entry->data, block, DEDUP_BLOCK) != 0)
+			continue;
+
+		if (entry == old)
+			return 0;
+
+		entry->refs++;
+		vault->blocks[idx] = entry;
+
+		if (old != NULL)
+			dedup_put(vault, old);
+		else
+			vault->dedup_mapped++;
+
+		return 0;
+	}
+
+	if (old != NULL && old->refs == 1) {
+		hlist_del(&old->node);
+		memcpy(old->data, block, DEDUP_BLOCK);
+		old->hash = hash;
+		hlist_add_head(&old->node, bucket);
+
+		return 0;
+	}
+
+	entry = kmalloc(sizeof(dedup_block_t), gfp);
+	if (entry == NULL)
+		return -ENOMEM;
+
+	entry->data = kmalloc(DEDUP_BLOCK, gfp);
+	if (entry->data == NULL) {
+		kfree(entry);
+		return -ENOMEM;
+	}
+
+	memcpy(entry->data, block, DEDUP_BLOCK);
+	entry->hash = hash;
+	entry->refs = 1;
+	hlist_add_head(&entry->node, bucket);
+
+	vault->dedup_stored++;
+	vault->data_bytes += DEDUP_BLOCK;
+	atomic_long_add(DEDUP_BLOCK, &storage_bytes);
+
+	vault->blocks[idx] = entry;
+
+	if (old != NULL)
+		dedup_put(vault, old);
+	else
+		vault->dedup_mapped++;
+
+	return 0;
+}
+
+/**
+ * @brief Read from or write into a deduplicated vault.
+ * @details The request is processed block by block while holding the lock of the vault. Writes decrypt the touched blocks, apply the new data and store them with `dedup_store()`.
+ * @param vault The vault to access.
+ * @param user The buffer in userspace.
+ * @param len The length of the buffer.
+ * @param offset The offset in the vault.
+ * @param write Specifies whether the request is a write.
+ * @param nowait Specifies whether the request must not wait.
+ * @return Size of the data read or written, negative value on error, `-EAGAIN` if the vault is not deduplicated, `-EBUSY` if `nowait` is set and nothing could be done without waiting.
+ */
+static ssize_t vault_io_dedup(vault_t *vault, void __user *user, size_t len, loff_t *offset, int write, int nowait)
+{
+	unsigned long limit, pos, end, in_block, part;
+	size_t to_copy, alloc_len, not_copied;
+	char *buffer, *block;
+	ssize_t ret = 0;
+	u64 start;
+
+	if (READ_ONCE(vault->blocks) == NULL)
+		return -EAGAIN;
+
+	if (nowait) {
+		if (vault_trylock(vault))
+			return -EBUSY;
+	} else if (vault_lock_foreground(vault)) {
+		return -ERESTARTSYS;
+	}
+
+	if (!vault->in_use || vault->blocks == NULL) {
+		vault_unlock(vault);
+		return -EAGAIN;
+	}
+
+	if (vault->owner != get_current_uid()) {
+		vault_unlock(vault);
+		return -EACCES;
+	}
+
+	limit = write ? vault->size : vault->used_space;
+
+	if (*offset >= limit) {
+		vault_unlock(vault);
+		return 0;
+	}
+
+	to_copy = alloc_len = min_t(size_t, len, limit - *offset);
+
+	buffer = kvmalloc(alloc_len, request_gfp(nowait));
+	block = kmalloc(DEDUP_BLOCK, request_gfp(nowait));
+	if (buffer == NULL || block == NULL) {
+		kvfree(buffer);
+		kfree(block);
+		vault_unlock(vault);
+		return nowait ? -EBUSY : -ENOMEM;
+	}
+
+	if (write) {
+		not_copied = copy_from_user(buffer, user, to_copy);
+		to_copy -= not_copied;
+	}
+
+	end = *offset + to_copy;
+
+	start = ktime_get_ns();
+
+	for (pos = *offset; pos < end; pos += part) {
+		dedup_block_t *entry = vault->blocks[pos / DEDUP_BLOCK];
+
+		in_block = pos % DEDUP_BLOCK;
+		part = min(end - pos, DEDUP_BLOCK - in_block);
+
+		if (entry != NULL)
+			memcpy(block, entry->data, DEDUP_BLOCK);
+		else
+			memset(block, 0, DEDUP_BLOCK);
+
+		if (!write) {
+			xor_copy(buffer + (pos - *offset), block + in_block, part, in_block, vault->key);
+			continue;
+		}
+
+		xor_buffer(block, DEDUP_BLOCK, 0, vault->key);
+		memcpy(block + in_block, buffer + (pos - *offset), part);
+
+		ret = dedup_store(vault, pos / DEDUP_BLOCK, block, request_gfp(nowait));
+		if (ret == -ENOMEM && nowait)
+			ret = -EBUSY;
+
+		if (ret)
+			break;
+	}
+
+	cgroup_charge(current_cgroup(), start, 1, 0);
+
+	// A write that ran out of memory reports the blocks stored before.
+	if (pos < end) {
+		to_copy = pos - *offset;
+		end = pos;
+	}
+
+	if (write) {
+		if (end > vault->used_space)
+			vault->used_space = end;
+
+		if (to_copy > 0)
+			atomic64_inc(&vault->generation);
+	} else {
+		not_copied = copy_to_user(user, buffer, to_copy);
+		to_copy -= not_copied;
+	}
+
+	memzero_explicit(block, DEDUP_BLOCK);
+	kfree(block);
+	kvfree_sensitive(buffer, alloc_len);
+
+	vault_unlock(vault);
+
+	if (to_copy == 0 && ret)
+		return ret;
+
+	*offset += to_copy;
+
+	return to_copy;
+}
+
+/**
+ * @brief Get the number of bytes queued in a queue vault.
+ * @param vault The vault to check.
+ * @return The number of bytes of all queued messages, including their headers.
+ */
+static unsigned long queue_used(vault_t *vault)
+{
+	return READ_ONCE(vault->queue_head) - READ_ONCE(vault->queue_tail);
+}
+
+/**
+ * @brief Copy data into the ring of a queue vault.
+ * @param vault The vault to copy into.
+ * @param pos The position in the queue, which wraps around at the end of the storage.
+ * @param src The data to copy.
+ * @param len The length of the data.
+ */
+static void queue_copy_in(vault_t *vault, unsigned long pos, const char *src, size_t len)
+{
+	unsigned long at = pos % vault->size;
+	size_t first = min_t(size_t, len, vault->size - at);
+
+	memcpy(vault->data + at, src, first);
+	memcpy(vault->data, src + first, len - first);
+}
+
+/**
+ * @brief Copy data out of the ring of a queue vault.
+ * @param vault The vault to copy from.
+ * @param pos The position in the queue, which wraps around at the end of the storage.
+ * @param dst The buffer to copy into.
+ * @param len The length of the data.
+ */
+static void queue_copy_out(vault_t *vault, unsigned long pos, char *dst, size_t len)
+{
+	unsigned long at = pos % vault->size;
+	size_t first = min_t(size_t, len, vault->size - at);
+
+	memcpy(dst, vault->data + at, first);
+	memcpy(dst + first, vault->data, len - first);
+}
+
+/**
+ * @brief Clear a range of the ring of a queue vault.
+ * @param vault The vault to clear.
+ * @param pos The position in the queue, which wraps around at the end of the storage.
+ * @param len The length of the range.
+ */
+static void queue_scrub(vault_t *vault, unsigned long pos, size_t len)
+{
+	unsigned long at = pos % vault->size;
+	size_t first = min_t(size_t, len, vault->size - at);
+
+	memzero_explicit(vault->data + at, first);
+	memzero_explicit(vault->data, len - first);
+}
+
+/**
+ * @brief Re-encrypt the queued messages of a queue vault with a new key.
+ * @details The caller must hold the lock of the queue.
+ * @param vault The vault to re-encrypt.
+ * @param key The new key.
+ */
+static void queue_rekey(vault_t *vault, const char *key)
+{
+	unsigned long pos;
+	char *data;
+
+	for (pos = vault->queue_tail; pos != vault->queue_head; pos++) {
+		data = vault->data + pos % vault->size;
+		*data ^= vault->key[pos % KEYSIZE] ^ key[pos % KEYSIZE];
+	}
+}
+
+/**
+ * @brief Take the lock of the producers or consumers of a queue vault.
+ * @param sem The lock to take.
+ * @param nowait Specifies whether the request must not wait.
+ * @return `0` on success, `-EBUSY` if `nowait` is set and the lock is held, `-ERESTARTSYS` if interrupted.
+ */
+static int queue_lock(struct semaphore *sem, int nowait)
+{
+	if (nowait)
+		return down_trylock(sem) ? -EBUSY : 0;
+
+	return down_interruptible(sem) ? -ERESTARTSYS : 0;
+}
+
+/**
+ * @brief Check whether a queue vault can be accessed by the current user.
+ * @details The caller must hold the lock of the producers or consumers, which keeps the vault from being deleted.
+ * @param vault The vault to check.
+ * @return `0` on success, `-EINVAL` if the vault is no longer a queue, `-EACCES` if the user does not own it.
+ */
+static int queue_check(vault_t *vault)
+{
+	if (!vault->in_use || !(vault->flags & VAULT_QUEUE))
+		return -EINVAL;
+
+	if (vault->owner != get_current_uid())
+		return -EACCES;
+
+	return 0;
+}
+
+/**
+ * @brief Enqueue a message into a queue vault.
+ * @details The message is encrypted with its position in the queue as cursor. Producers only take their own lock and publish the new head after the message is stored, so they do not serialize with consumers. If the queue is full, the producer waits for consumers outside of the lock.
+ * @param vault The vault to write into.
+ * @param user The message in userspace.
+ * @param len The length of the message.
+ * @param nowait Specifies whether the request must not wait.
+ * @return Size of the message, negative value on error, `-EMSGSIZE` if the message can never fit, `-EBUSY` if `nowait` is set and the queue is locked or full.
+ */
+static ssize_t queue_send(vault_t *vault, const char __user *user, size_t len, int nowait)
+{
+	size_t need = QUEUE_HEADER + len;
+	unsigned long head;
+	char *buffer;
+	ssize_t ret;
+	u32 header;
+	u64 start;
+
+	if (len == 0)
+		return 0;
+
+	if (len > MAX_DATA)
+		return -EMSGSIZE;
+
+	buffer = kmalloc(need, request_gfp(nowait));
+	if (buffer == NULL)
+		return nowait ? -EBUSY : -ENOMEM;
+
+	header = len;
+	memcpy(buffer, &header, QUEUE_HEADER);
+
+	if (copy_from_user(buffer + QUEUE_HEADER, user, len)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (;;) {
+		ret = queue_lock(&vault->queue_produce, nowait);
+		if (ret)
+			goto out;
+
+		ret = queue_check(vault);
+		if (ret == 0 && need > vault->size)
+			ret = -EMSGSIZE;
+
+		if (ret) {
+			up(&vault->queue_produce);
+			goto out;
+		}
+
+		// Consumers publish the tail after clearing the message, so the space behind it is free.
+		head = vault->queue_head;
+		if (vault->size - (head - smp_load_acquire(&vault->queue_tail)) >= need)
+			break;
+
+		up(&vault->queue_produce);
+
+		if (nowait) {
+			ret = -EBUSY;
+			goto out;
+		}
+
+		if (wait_event_interruptible(vault->poll_wait,
+				READ_ONCE(vault->size) - queue_used(vault) >= need || !READ_ONCE(vault->in_use))) {
+			ret = -ERESTARTSYS;
+			goto out;
+		}
+	}
+
+	start = ktime_get_ns();
+	xor_buffer(buffer, need, head, vault->key);
+	cgroup_charge(current_cgroup(), start, 1, 0);
+
+	queue_copy_in(vault, head, buffer, need);
+	smp_store_release(&vault->queue_head, head + need);
+	vault->queue_sent++;
+
+	up(&vault->queue_produce);
+
+	atomic64_inc(&vault->generation);
+	wake_up_interruptible_poll(&vault->poll_wait, EPOLLIN | EPOLLRDNORM);
+
+	ret = len;
+
+out:
+	memzero_explicit(buffer, need);
+	kfree(buffer);
+
+	return ret;
+}
+
+/**
+ * @brief Dequeue the oldest message of a queue vault.
+ * @details Consumers only take their own lock, and clear the message before they publish the new tail. If the queue is empty, the consumer waits for producers outside of the lock. A message that does not fit into the buffer stays queued.
+ * @param vault The vault to read from.
+ * @param user The buffer in userspace to read into.
+ * @param len The length of the buffer.
+ * @param nowait Specifies whether the request must not wait.
+ * @return Size of the message, negative value on error, `-EMSGSIZE` if the buffer is too small, `-EBUSY` if `nowait` is set and the queue is locked or empty.
+ */
+static ssize_t queue_receive(vault_t *vault, char __user *user, size_t len, int nowait)
+{
+	unsigned long tail;
+	char *buffer;
+	ssize_t ret;
+	u32 header;
+	u64 start;
+
+	for (;;) {
+		ret = queue_lock(&vault->queue_consume, nowait);
+		if (ret)
+			return ret;
+
+		ret = queue_check(vault);
+		if (ret) {
+			up(&vault->queue_consume);
+			return ret;
+		}
+
+		// Producers publish the head after storing the message, so everything before it is complete.
+		tail = vault->queue_tail;
+		if (smp_load_acquire(&vault->queue_head) != tail)
+			break;
+
+		up(&vault->queue_consume);
+
+		if (nowait)
+			return -EBUSY;
+
+		if (wait_event_interruptible(vault->poll_wait, queue_used(vault) > 0 || !READ_ONCE(vault->in_use)))
+			return -ERESTARTSYS;
+	}
+
+	queue_copy_out(vault, tail, (char *)&header, QUEUE_HEADER);
+	xor_buffer((char *)&header, QUEUE_HEADER, tail, vault->key);
+
+	if (header > vault->queue_head - tail - QUEUE_HEADER) {
+		printk("Message of secvault is corrupted.\n");
+		up(&vault->queue_consume);
+		return -EIO;
+	}
+
+	if (header > len) {
+		up(&vault->queue_consume);
+		return -EMSGSIZE;
+	}
+
+	buffer = kmalloc(header, request_gfp(nowait));
+	if (buffer == NULL) {
+		up(&vault->queue_consume);
+		return nowait ? -EBUSY : -ENOMEM;
+	}
+
+	queue_copy_out(vault, tail + QUEUE_HEADER, buffer, header);
+
+	start = ktime_get_ns();
+	xor_buffer(buffer, header, tail + QUEUE_HEADER, vault->key);
+	cgroup_charge(current_cgroup(), start, 1, 0);
+
+	if (copy_to_user(user, buffer, header)) {
+		ret = -EFAULT;
+	} else {
+		queue_scrub(vault, tail, QUEUE_HEADER + header);
+		smp_store_release(&vault->queue_tail, tail + QUEUE_HEADER + header);
+		vault->queue_received++;
+		ret = header;
+	}
+
+	up(&vault->queue_consume);
+
+	memzero_explicit(buffer, header);
+	kfree(buffer);
+
+	if (ret < 0)
+		return ret;
+
+	atomic64_inc(&vault->generation);
+	wake_up_interruptible_poll(&vault->poll_wait, EPOLLOUT | EPOLLWRNORM);
+
+	return ret;
+}
+
+/**
+ * @brief Read from or write into a queue vault.
+ * @details Reads dequeue one message and writes enqueue one, the offset of the file is not used.
+ * @param vault The vault to access.
+ * @param user The buffer in userspace.
+ * @param len The length of the buffer.
+ * @param write Specifies whether the request is a write.
+ * @param nowait Specifies whether the request must not wait.
+ * @return Size of the message, negative value on error, `-EAGAIN` if the vault is not a queue, `-EBUSY` if `nowait` is set and the request would have to wait.
+ */
+static ssize_t vault_io_queue(vault_t *vault, void __user *user, size_t len, int write, int nowait)
+{
+	if (!(READ_ONCE(vault->flags) & VAULT_QUEUE))
+		return -EAGAIN;
+
+	return write ? queue_send(vault, user, len, nowait) : queue_receive(vault, user, len, nowait);
+}
+
+/**
+ * @brief Read a small amount of data from a vault without taking its lock.
+ * @details The region and the data are copied while the sequence counter of the vault is stable, and the copy is only used if no modification intervened. The storage cannot be freed during the copy, as it is released after a grace period. Replicated vaults always fall back to the lock.
+ * @param vault The vault to read from.
+ * @param part_idx The index of the partition to read from, negative value for the whole vault.
+ * @param user The buffer in userspace to read into.
+ * @param len The length of the buffer to read into, at most `SEQREAD_MAX`.
+ * @param offset The offset in the region to read from.
+ * @param lat The latency measurement of the request, may be `NULL`.
+ * @return Size of the data read, negative value on error, `-EAGAIN` if the read has to take the lock.
+ */
+static ssize_t vault_read_optimistic(vault_t *vault, int part_idx, char __user *user, size_t len, loff_t *offset,
+		latency_t *lat)
+{
+	char buffer[SEQREAD_MAX];
+	char key[KEYSIZE];
+	uid_t uid = get_current_uid();
+	unsigned long used = 0;
+	region_t region;
+	size_t not_copied;
+	size_t to_copy;
+	unsigned int seq;
+	const char *data = NULL;
+	int tries, usable;
+	u64 start;
+
+	for (tries = 0; tries < SEQREAD_TRIES; tries++) {
+		seq = raw_read_seqcount(&vault->seq);
+
+		// A modification in progress may take long, so the read goes to the lock right away.
+		if (seq & 1)
+			break;
+
+		rcu_read_lock();
+
+		usable = READ_ONCE(vault->in_use) && READ_ONCE(vault->replicas) == NULL && READ_ONCE(vault->stripes) == NULL &&
+				READ_ONCE(vault->blocks) == NULL && vault_region(vault, part_idx, uid, &region) == 0;
+
+		if (usable) {
+			data = READ_ONCE(vault->data);
+			used = READ_ONCE(*region.used_space);
+			memcpy(key, region.key, KEYSIZE);
+		}
+
+		// The region must be consistent before it is used to access the storage.
+		if (read_seqcount_retry(&vault->seq, seq)) {
+			rcu_read_unlock();
+			continue;
+		}
+
+		if (!usable) {
+			rcu_read_unlock();
+			break;
+		}
+
+		to_copy = *offset < used ? min_t(size_t, len, used - *offset) : 0;
+		memcpy(buffer, data + region.start + *offset, to_copy);
+
+		rcu_read_unlock();
+
+		if (read_seqcount_retry(&vault->seq, seq))
+			continue;
+
+		start = ktime_get_ns();
+		xor_buffer(buffer, to_copy, *offset, key);
+		cgroup_charge(current_cgroup(), start, 1, 0);
+		latency_mark(lat, PHASE_TRANSFORM);
+
+		not_copied = copy_to_user(user, buffer, to_copy);
+		memzero_explicit(buffer, to_copy);
+		memzero_explicit(key, KEYSIZE);
+		latency_mark(lat, PHASE_COPY);
+
+		*offset += to_copy - not_copied;
+
+		return to_copy - not_copied;
+	}
+
+	atomic_long_inc(&vault->seq_fallbacks);
+
+	return -EAGAIN;
+}
+
+/**
+ * @brief Read a small amount of data from a vault by combining the request with others.
+ * @param vault The vault to read from.
+ * @param part_idx The index of the partition to read from, negative value for the whole vault.
+ * @param user The buffer in userspace to read into.
+ * @param len The length of the buffer to read into, at most `COMBINE_MAX`.
+ * @param offset The offset in the region to read from.
+ * @param nowait Specifies whether the request must not wait.
+ * @param lat The latency measurement of the request, may be `NULL`.
+ * @return Negative value on error, size of the data read otherwise.
+ */
+static ssize_t vault_read_combined(vault_t *vault, int part_idx, char __user *user, size_t len, loff_t *offset,
+		int nowait, latency_t *lat)
+{
+	combine_op_t op;
+	size_t not_copied;
+	int ret;
+
+	op.write = 0;
+	op.part_idx = part_idx;
+	op.uid = get_current_uid();
+	op.cgroup = current_cgroup();
+	op.numa = numa_node_id();
+	op.offset = *offset;
+	op.len = len;
+
+	latency_skip(lat);
+	ret = vault_submit(vault, &op, nowait);
+	latency_mark(lat, PHASE_LOCK);
+
+	if (ret)
+		return ret;
+
+	if (op.result <= 0)
+		return op.result;
+
+	not_copied = copy_to_user(user, op.buffer, op.result);
+	memzero_explicit(op.buffer, op.result);
+	latency_mark(lat, PHASE_COPY);
+
+	*offset += op.result - not_copied;
+
+	return op.result - not_copied;
+}
+
+/**
+ * @brief Write a small amount of data into a vault by combining the request with others.
+ * @param vault The vault to write into.
+ * @param part_idx The index of the partition to write into, negative value for the whole vault.
+ * @param user The buffer in userspace to read from.
+ * @param len The length of the buffer to read from, at most `COMBINE_MAX`.
+ * @param offset The offset in the region to write into.
+ * @param nowait Specifies whether the request must not wait.
+ * @param lat The latency measurement of the request, may be `NULL`.
+ * @return Negative value on error, size of the data written otherwise.
+ */
+static ssize_t vault_write_combined(vault_t *vault, int part_idx, const char __user *user, size_t len, loff_t *offset,
+		int nowait, latency_t *lat)
+{
+	combine_op_t op;
+	size_t not_copied;
+	int ret;
+
+	latency_skip(lat);
+	not_copied = copy_from_user(op.buffer, user, len);
+	latency_mark(lat, PHASE_COPY);
+
+	op.write = 1;
+	op.part_idx = part_idx;
+	op.uid = get_current_uid();
+	op.cgroup = current_cgroup();
+	op.numa = numa_node_id();
+	op.offset = *offset;
+	op.len = len - not_copied;
+
+	if (op.len == 0)
+		return 0;
+
+	op.rec = journal_alloc(vault, op.len, nowait);
+	if (IS_ERR(op.rec))
+		return PTR_ERR(op.rec);
+
+	ret = vault_submit(vault, &op, nowait);
+	latency_mark(lat, PHASE_LOCK);
+	memzero_explicit(op.buffer, op.len);
+	kvfree(op.rec);
+
+	if (ret)
+		return ret;
+
+	if (op.result <= 0)
+		return op.result;
+
+	*offset += op.result;
+
+	return op.result;
+}
+
+/**
+ * @brief Handler for opening a vault.
+ * @details This function is called whenever `open()` is called on a vault file descriptor.
+ * @param inode The inode of the resource.
+ * @param file The file struct of the resource.
+ * @return `0` on success, negative value otherwise.
+ */
+static int vault_open(struct inode *inode, struct file *file)
+{
+	vault_t *vault;
+	int dev_idx = MINOR(inode->i_rdev);
+
+	vault = &vaults[dev_idx];
+
+	if (vault->owner != get_current_uid() && !vault_owns_partition(vault, get_current_uid())) {
+		printk("User has no permission to open this secvault.\n");
+		return -EACCES;
+	}
+
+	// Requests with `RWF_NOWAIT` are only accepted by files that support them, which `vault_rw_iter()` does.
+	file->f_mode |= FMODE_NOWAIT;
+
+	return 0;
+}
+
+/**
+ * @brief Handler for closing a vault.
+ * @details This function is called whenever `close()` is called on a vault file descriptor.
+ * @param inode The inode of the resource.
+ * @param file The file struct of the resource.
+ * @return `0` on success, negative value otherwise.
+ */
+static int vault_release(struct inode *inode, struct file *file)
+{
+	vault_t *vault;
+	int dev_idx = MINOR(inode->i_rdev);
+
+	vault = &vaults[dev_idx];
+
+	if (file_partition(file) >= 0) {
+		atomic_dec(&vault->parts[file_partition(file)].users);
+		return 0;
+	}
+
+	if (vault->owner != get_current_uid()) {
+		printk("User has no permission to release this secvault.\n");
+		return -EACCES;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Handler for synchronizing a vault.
+ * @details This function is called whenever `fsync()` or `fdatasync()` is called on a vault file descriptor. The modifications of a persistent vault logged so far are committed, in one group with those of concurrent callers. Vaults that are not persistent have nothing to synchronize.
+ * @param file The file struct of the resource.
+ * @param start The start of the range to synchronize, unused.
+ * @param end The end of the range to synchronize, unused.
+ * @param datasync Specifies whether only the data has to be synchronized, unused.
+ * @return `0` on success, the first error of a commit since the last call otherwise. The error is reported again until the backing file was rewritten after it.
+ */
+static int vault_fsync(struct file *file, loff_t start, loff_t end, int datasync)
+{
+	vault_t *vault = &vaults[MINOR(file->f_inode->i_rdev)];
+	int ret;
+
+	journal_commit(vault);
+
+	mutex_lock(&vault->journal_mutex);
+	ret = vault->journal_error;
+
+	if (!vault->journal_failed)
+		vault->journal_error = 0;
+
+	mutex_unlock(&vault->journal_mutex);
+
+	return ret;
+}
+
+/**
+ * @brief Handler for seeking a vault.
+ * @details This function is called whenever `seek()` is called on a vault file descriptor.
+ * @param file The file struct of the resource.
+ * @param offset The offset to seek.
+ * @param whence The mode for seeking the file.
+ * @return The new absolute offset in the file.
+ */
+static loff_t vault_llseek(struct file *file, loff_t offset, int whence)
+{
+	vault_t *vault;
+	region_t region;
+	loff_t new_offset;
+	int dev_idx;
+
+	dev_idx = MINOR(file->f_inode->i_rdev);
+	vault = &vaults[dev_idx];
+
+	if (vault_lock_interruptible(vault))
+		return -ERESTARTSYS;
+
+	if (vault_region(vault, file_partition(file), get_current_uid(), &region)) {
+		printk("User has no permission to seek this secvault.\n");
+		vault_unlock(vault);
+		return -EACCES;
+	}
+
+	switch (whence) {
+	case SEEK_SET:
+		new_offset = offset;
+		break;
+	case SEEK_CUR:
+		new_offset = file->f_pos + offset;
+		break;
+	case SEEK_END:
+		new_offset = region.size - 1 - offset;
+		break;
+	default:
+		vault_unlock(vault);
+		return -EINVAL;
+	}
+
+	if (new_offset < 0 || new_offset >= region.size) {
+		vault_unlock(vault);
+		return -EINVAL;
+	}
+
+	file->f_pos = new_offset;
+
+	vault_unlock(vault);
+
+	return new_offset;
+}
+
+/**
+ * @brief Check whether a request is served directly from the user pages.
+ * @details Replicated vaults are excluded, as their writes would have to be transformed once per copy.
+ * @param vault The vault to access.
+ * @param len The length of the request.
+ * @return `1` if the request is large enough, `0` otherwise.
+ */
+static int zerocopy_wanted(vault_t *vault, size_t len)
+{
+	unsigned int min = READ_ONCE(zerocopy_min);
+
+	return min > 0 && len >= min && vault->replicas == NULL;
+}
+
+/**
+ * @brief Pin the pages of a buffer in userspace.
+ * @param addr The address of the buffer.
+ * @param len The length of the buffer.
+ * @param write Specifies whether the pages are written by the kernel.
+ * @param n_pages The number of pinned pages.
+ * @return The pinned pages, `NULL` if not all pages could be pinned.
+ */
+static struct page **zerocopy_pin(unsigned long addr, size_t len, int write, unsigned long *n_pages)
+{
+	unsigned long n = ((addr + len - 1) >> PAGE_SHIFT) - (addr >> PAGE_SHIFT) + 1;
+	struct page **pages;
+	long pinned;
+
+	pages = kvmalloc_array(n, sizeof(struct page *), GFP_KERNEL);
+	if (pages == NULL)
+		return NULL;
+
+	pinned = pin_user_pages_fast(addr & PAGE_MASK, n, write ? FOLL_WRITE : 0, pages);
+	if (pinned != n) {
+		if (pinned > 0)
+			unpin_user_pages(pages, pinned);
+
+		kvfree(pages);
+		return NULL;
+	}
+
+	*n_pages = n;
+
+	return pages;
+}
+
+/**
+ * @brief Transform data between pinned user pages and the storage.
+ * @details Every page is mapped only while it is transformed, and the CPU is yielded between pages, as the transform may cover a whole vault.
+ * @param pages The pinned pages of the user buffer.
+ * @param addr The address of the user buffer.
+ * @param data The storage to transform into or from.
+ * @param len The length of the data.
+ * @param offset The offset of the encryption cursor.
+ * @param key The key to apply.
+ * @param write Specifies whether the data is written into the storage.
+ */
+static void zerocopy_transform(struct page **pages, unsigned long addr, char *data, size_t len, loff_t offset, char *key,
+		int write)
+{
+	unsigned long page_off;
+	size_t done, chunk;
+	char *mapped;
+
+	for (done = 0; done < len; done += chunk) {
+		page_off = offset_in_page(addr + done);
+		chunk = min_t(size_t, len - done, PAGE_SIZE - page_off);
+
+		mapped = kmap_local_page(pages[((addr + done) >> PAGE_SHIFT) - (addr >> PAGE_SHIFT)]);
+
+		if (write)
+			xor_copy(data + done, mapped + page_off, chunk, offset + done, key);
+		else
+			xor_copy(mapped + page_off, data + done, chunk, offset + done, key);
+
+		kunmap_local(mapped);
+		cond_resched();
+	}
+}
+
+/**
+ * @brief Read data from a region of a vault directly into the pages of the user buffer.
+ * @details The caller must hold the lock of the vault.
+ * @param vault The vault to read from.
+ * @param region The region of the vault to read from.
+ * @param user The buffer in userspace to read into.
+ * @param len The length of the data to read, within the used space of the region.
+ * @param offset The offset in the region to read from.
+ * @param lat The latency measurement of the request, may be `NULL`.
+ * @return Size of the data read, `-EAGAIN` if the pages could not be pinned.
+ */
+static ssize_t vault_read_pinned(vault_t *vault, region_t *region, char __user *user, size_t len, loff_t *offset,
+		latency_t *lat)
+{
+	unsigned long n_pages;
+	struct page **pages;
+	u64 start;
+
+	pages = zerocopy_pin((unsigned long)user, len, 1, &n_pages);
+	latency_mark(lat, PHASE_COPY);
+
+	if (pages == NULL) {
+		atomic_long_inc(&zerocopy_fallbacks);
+		return -EAGAIN;
+	}
+
+	start = ktime_get_ns();
+	zerocopy_transform(pages, (unsigned long)user, vault_local_data(vault) + region->start + *offset, len, *offset,
+			region->key, 0);
+	cgroup_charge(current_cgroup(), start, 1, 0);
+	latency_mark(lat, PHASE_TRANSFORM);
+
+	unpin_user_pages_dirty_lock(pages, n_pages, true);
+	kvfree(pages);
+
+	atomic_long_inc(&zerocopy_requests);
+
+	*offset += len;
+
+	return len;
+}
+
+/**
+ * @brief Write data from the pages of the user buffer directly into a region of a vault.
+ * @details The caller must hold the lock of the vault. The transform runs in a preemptible modification of the vault, during which lockless readers take the lock instead.
+ * @param vault The vault to write into.
+ * @param region The region of the vault to write into.
+ * @param user The buffer in userspace to read from.
+ * @param len The length of the data to write, within the size of the region.
+ * @param offset The offset in the region to write into.
+ * @param rec The journal record reserved for the write, consumed unless the pages could not be pinned, may be `NULL`.
+ * @param lat The latency measurement of the request, may be `NULL`.
+ * @return Size of the data written, `-EAGAIN` if the pages could not be pinned.
+ */
+static ssize_t vault_write_pinned(vault_t *vault, region_t *region, const char __user *user, size_t len, loff_t *offset,
+		journal_rec_t *rec, latency_t *lat)
+{
+	unsigned long n_pages;
+	struct page **pages;
+	u64 start;
+
+	pages = zerocopy_pin((unsigned long)user, len, 0, &n_pages);
+	latency_mark(lat, PHASE_COPY);
+
+	if (pages == NULL) {
+		atomic_long_inc(&zerocopy_fallbacks);
+		return -EAGAIN;
+	}
+
+	start = ktime_get_ns();
+
+	vault_seq_begin(vault);
+
+	if (*offset + len > *region->used_space)
+		*region->used_space = *offset + len;
+
+	vault_scrub_range(vault, region->start, region->start + *offset + len);
+	zerocopy_transform(pages, (unsigned long)user, vault->data + region->start + *offset, len, *offset,
+			region->key, 1);
+	vault_seq_end(vault);
+
+	cgroup_charge(current_cgroup(), start, 1, 0);
+	latency_mark(lat, PHASE_TRANSFORM);
+	journal_log(vault, rec, JOURNAL_WRITE, region->start + *offset, len);
+	atomic64_inc(region->generation);
+
+	unpin_user_pages(pages, n_pages);
+	kvfree(pages);
+
+	atomic_long_inc(&zerocopy_requests);
+
+	*offset += len;
+
+	return len;
+}
+
+/**
+ * @brief Read data from a region of a secure vault while holding its lock.
+ * @details Data is first copied into an internal buffer, decrypted and then copied to userspace. Reads of at least `zerocopy_min` bytes are decrypted directly into the user pages by `vault_read_pinned()`.
+ * @param vault The vault to read from.
+ * @param region The region of the vault to read from.
+ * @param user The buffer in userspace to read into.
+ * @param len The length of the buffer to read into.
+ * @param offset The offset in the region to read from.
+ * @param nowait Specifies whether the request must not wait. Such requests do not pin the user pages, which may fault them in.
+ * @param lat The latency measurement of the request, may be `NULL`.
+ * @return Negative value on error, `-EBUSY` if `nowait` is set and memory is short, size of the data read otherwise.
+ */
+static ssize_t vault_read_locked(vault_t *vault, region_t *region, char __user *user, size_t len, loff_t *offset,
+		int nowait, latency_t *lat)
+{
+	size_t not_copied;
+	size_t len_avail;
+	size_t to_copy;
+	char *buffer;
+	ssize_t ret;
+	u64 start;
+
+	// Striped, deduplicated and queue vaults are only accessed through their own paths.
+	if (vault->stripes != NULL || vault->blocks != NULL || (vault->flags & VAULT_QUEUE))
+		return -EINVAL;
+
+	if (*offset >= *region->used_space)
+		return 0;
+
+	len_avail = *region->used_space - *offset;
+
+	if (len_avail < len)
+		to_copy = len_avail;
+	else
+		to_copy = len;
+
+	if (!nowait && zerocopy_wanted(vault, to_copy)) {
+		ret = vault_read_pinned(vault, region, user, to_copy, offset, lat);
+		if (ret != -EAGAIN)
+			return ret;
+	}
+
+	latency_skip(lat);
+	buffer = kmalloc(to_copy * sizeof(char), request_gfp(nowait));
+	latency_mark(lat, PHASE_ALLOC);
+
+	if (buffer == NULL && nowait)
+		return -EBUSY;
+
+	if (buffer == NULL) {
+		printk("Could not allocate memory to read secvault.\n");
+		return -ENOMEM;
+	}
+
+	memcpy(buffer, vault_local_data(vault) + region->start + *offset, to_copy);
+
+	start = ktime_get_ns();
+	xor_buffer(buffer, to_copy, *offset, region->key);
+	cgroup_charge(current_cgroup(), start, 1, 0);
+	latency_mark(lat, PHASE_TRANSFORM);
+
+	not_copied = copy_to_user(user, buffer, to_copy);
+	latency_mark(lat, PHASE_COPY);
+
+	kfree(buffer);
+
+	*offset += to_copy - not_copied;
+
+	return to_copy - not_copied;
+}
+
+/**
+ * @brief Read data from a secure vault.
+ * @details Queue vaults are read by `vault_io_queue()`, striped vaults by `vault_io_striped()`, deduplicated vaults by `vault_io_dedup()`. The smallest reads are served without the lock by `vault_read_optimistic()`. Small reads are combined with other requests by `vault_read_combined()`, otherwise the vault is locked and read by `vault_read_locked()`. Files that selected a partition read from the partition.
+ * @param file The file the read from.
+ * @param user The buffer in userspace to read into.
+ * @param len The length of the buffer to read into.
+ * @param offset The offset in the file to read from.
+ * @param nowait Specifies whether the read must not wait for a lock or for memory reclaim.
+ * @param lat The latency measurement of the request.
+ * @return Negative value on error, `-EBUSY` if `nowait` is set and the read would have to wait, size of the data read otherwise.
+ */
+static ssize_t vault_read_request(struct file *file, char __user *user, size_t len, loff_t *offset, int nowait,
+		latency_t *lat)
+{
+	vault_t *vault;
+	region_t region;
+	ssize_t ret;
+	int dev_idx;
+
+	dev_idx = MINOR(file->f_inode->i_rdev);
+	vault = &vaults[dev_idx];
+
+	governor_note(vault);
+
+	if (file_partition(file) < 0) {
+		ret = vault_io_queue(vault, user, len, 0, nowait);
+		if (ret == -EACCES)
+			printk("User has no permission to read this secvault.\n");
+
+		if (ret != -EAGAIN)
+			return ret;
+
+		ret = vault_io_striped(vault, user, len, offset, 0, nowait);
+		if (ret != -EAGAIN)
+			return ret;
+
+		ret = vault_io_dedup(vault, user, len, offset, 0, nowait);
+		if (ret == -EACCES)
+			printk("User has no permission to read this secvault.\n");
+
+		if (ret != -EAGAIN)
+			return ret;
+	}
+
+	if (len <= SEQREAD_MAX) {
+		ret = vault_read_optimistic(vault, file_partition(file), user, len, offset, lat);
+		if (ret != -EAGAIN)
+			return ret;
+	}
+
+	if (len <= COMBINE_MAX) {
+		ret = vault_read_combined(vault, file_partition(file), user, len, offset, nowait, lat);
+		if (ret == -EACCES)
+			printk("User has no permission to read this secvault.\n");
+
+		return ret;
+	}
+
+	latency_skip(lat);
+
+	if (nowait) {
+		if (vault_trylock(vault))
+			return -EBUSY;
+	} else if (vault_lock_foreground(vault)) {
+		return -ERESTARTSYS;
+	}
+
+	latency_mark(lat, PHASE_LOCK);
+
+	if (vault_region(vault, file_partition(file), get_current_uid(), &region)) {
+		printk("User has no permission to read this secvault.\n");
+		vault_unlock(vault);
+		return -EACCES;
+	}
+
+	ret = vault_read_locked(vault, &region, user, len, offset, nowait, lat);
+
+	vault_unlock(vault);
+
+	return ret;
+}
+
+/**
+ * @brief Account a request and translate the result of a non-blocking one.
+ * @details The paths of a request use `-EAGAIN` to hand it on to the next path, so requests that would have to wait report `-EBUSY` until here.
+ * @param ret The result of the request.
+ * @param nowait Specifies whether the request was non-blocking.
+ * @return The result to return to userspace.
+ */
+static ssize_t request_result(ssize_t ret, int nowait)
+{
+	if (!nowait)
+		return ret;
+
+	atomic_long_inc(&nowait_requests);
+
+	if (ret != -EBUSY)
+		return ret;
+
+	atomic_long_inc(&nowait_busy);
+
+	return -EAGAIN;
+}
+
+/**
+ * @brief Handler for reading a vault.
+ * @details This function is called whenever `read()` is called on a vault file descriptor. Files opened with `O_NONBLOCK` fail with `-EAGAIN` instead of waiting.
+ * @param file The file the read from.
+ * @param user The buffer in userspace to read into.
+ * @param len The length of the buffer to read into.
+ * @param offset The offset in the file to read from.
+ * @return Negative value on error, size of the data read otherwise.
+ */
+static ssize_t vault_read(struct file *file, char __user *user, size_t len, loff_t *offset)
+{
+	int nowait = !!(file->f_flags & O_NONBLOCK);
+	latency_t lat;
+	ssize_t ret;
+
+	latency_begin(&lat, file, 0);
+	ret = vault_read_request(file, user, len, offset, nowait, &lat);
+	latency_end(&lat);
+
+	return request_result(ret, nowait);
+}
+
+/**
+ * @brief Write data into a region of a secure vault while holding its lock.
+ * @details Data is first copied into an internal buffer from userspace, encrypted and then copied to the vault. Writes of at least `zerocopy_min` bytes are encrypted directly from the user pages by `vault_write_pinned()`.
+ * @param vault The vault to write into.
+ * @param region The region of the vault to write into.
+ * @param user The buffer in userspace to read from.
+ * @param len The length of the buffer to read from.
+ * @param offset The offset in the region to write into.
+ * @param nowait Specifies whether the request must not wait. Such requests do not pin the user pages, which may fault them in.
+ * @param lat The latency measurement of the request, may be `NULL`.
+ * @return Negative value on error, `-EBUSY` if `nowait` is set and memory is short or the journal is behind, size of the data written otherwise.
+ */
+static ssize_t vault_write_locked(vault_t *vault, region_t *region, const char __user *user, size_t len, loff_t *offset,
+		int nowait, latency_t *lat)
+{
+	size_t not_copied;
+	size_t len_avail;
+	size_t to_copy;
+	size_t max_written;
+	journal_rec_t *rec;
+	char *buffer;
+	ssize_t ret;
+	u64 start;
+
+	// Striped, deduplicated and queue vaults are only accessed through their own paths.
+	if (vault->stripes != NULL || vault->blocks != NULL || (vault->flags & VAULT_QUEUE))
+		return -EINVAL;
+
+	if (*offset >= region->size)
+		return 0;
+
+	len_avail = region->size - *offset;
+
+	if (len_avail < len)
+		to_copy = len_avail;
+	else
+		to_copy = len;
+
+	latency_skip(lat);
+	rec = journal_alloc(vault, to_copy, nowait);
+	latency_mark(lat, PHASE_ALLOC);
+
+	if (IS_ERR(rec))
+		return PTR_ERR(rec);
+
+	if (!nowait && zerocopy_wanted(vault, to_copy)) {
+		ret = vault_write_pinned(vault, region, user, to_copy, offset, rec, lat);
+		if (ret != -EAGAIN)
+			return ret;
+	}
+
+	latency_skip(lat);
+	buffer = kmalloc(to_copy * sizeof(char), request_gfp(nowait));
+	latency_mark(lat, PHASE_ALLOC);
+
+	if (buffer == NULL) {
+		kvfree(rec);
+
+		if (nowait)
+			return -EBUSY;
+
+		printk("Could not allocate memory to write secvault.\n");
+		return -ENOMEM;
+	}
+
+	not_copied = copy_from_user(buffer, user, to_copy);
+	latency_mark(lat, PHASE_COPY);
+
+	start = ktime_get_ns();
+	xor_buffer(buffer, to_copy, *offset, region->key);
+	cgroup_charge(current_cgroup(), start, 1, 0);
+
+	// Calculate new possible used_space.
+	max_written = *offset + to_copy - not_copied;
+
+	vault_seq_begin(vault);
+
+	if (max_written > *region->used_space)
+		*region->used_space = max_written;
+
+	vault_scrub_range(vault, region->start, region->start + max_written);
+	vault_store(vault, region->start + *offset, buffer, to_copy - not_copied);
+	vault_seq_end(vault);
+	latency_mark(lat, PHASE_TRANSFORM);
+
+	if (to_copy > not_copied)
+		journal_log(vault, rec, JOURNAL_WRITE, region->start + *offset, to_copy - not_copied);
+	else
+		kvfree(rec);
+
+	atomic64_inc(region->generation);
+
+	kfree(buffer);
+
+	*offset += to_copy - not_copied;
+
+	return to_copy - not_copied;
+}
+
+/**
+ * @brief Write data from a secure vault.
+ * @details Queue vaults are written by `vault_io_queue()`, striped vaults by `vault_io_striped()`, deduplicated vaults by `vault_io_dedup()`. Small writes are combined with other requests by `vault_write_combined()`, otherwise the vault is locked and written by `vault_write_locked()`. Files that selected a partition write into the partition.
+ * @param file The file the write into.
+ * @param user The buffer in userspace to read from.
+ * @param len The length of the buffer to read from.
+ * @param offset The offset in the file to write into.
+ * @param nowait Specifies whether the write must not wait for a lock or for memory reclaim.
+ * @param lat The latency measurement of the request.
+ * @return Negative value on error, `-EBUSY` if `nowait` is set and the write would have to wait, size of the data written otherwise.
+ */
+static ssize_t vault_write_request(struct file *file, const char __user *user, size_t len, loff_t *offset,
+		int nowait, latency_t *lat)
+{
+	vault_t *vault;
+	region_t region;
+	ssize_t ret;
+	int dev_idx;
+
+	dev_idx = MINOR(file->f_inode->i_rdev);
+	vault = &vaults[dev_idx];
+
+	governor_note(vault);
+
+	if (file_partition(file) < 0) {
+		ret = vault_io_queue(vault, (void __user *)user, len, 1, nowait);
+		if (ret == -EACCES)
+			printk("User has no permission to write secvault.\n");
+
+		if (ret != -EAGAIN)
+			return ret;
+
+		ret = vault_io_striped(vault, (void __user *)user, len, offset, 1, nowait);
+		if (ret != -EAGAIN)
+			return ret;
+
+		ret = vault_io_dedup(vault, (void __user *)user, len, offset, 1, nowait);
+		if (ret == -EACCES)
+			printk("User has no permission to write secvault.\n");
+
+		if (ret != -EAGAIN)
+			return ret;
+	}
+
+	if (len <= COMBINE_MAX) {
+		ret = vault_write_combined(vault, file_partition(file), user, len, offset, nowait, lat);
+		if (ret == -EACCES)
+			printk("User has no permission to write secvault.\n");
+
+		return ret;
+	}
+
+	latency_skip(lat);
+
+	if (nowait) {
+		if (vault_trylock(vault))
+			return -EBUSY;
+	} else if (vault_lock_foreground(vault)) {
+		return -ERESTARTSYS;
+	}
+
+	latency_mark(lat, PHASE_LOCK);
+
+	if (vault_region(vault, file_partition(file), get_current_uid(), &region)) {
+		printk("User has no permission to write secvault.\n");
+		vault_unlock(vault);
+		return -EACCES;
+	}
+
+	ret = vault_write_locked(vault, &region, user, len, offset, nowait, lat);
+
+	vault_unlock(vault);
+
+	return ret;
+}
+
+/**
+ * @brief Handler for writing a vault.
+ * @details This function is called whenever `write()` is called on a vault file descriptor. Files opened with `O_NONBLOCK` fail with `-EAGAIN` instead of waiting.
+ * @param file The file the write into.
+ * @param user The buffer in userspace to read from.
+ * @param len The length of the buffer to read from.
+ * @param offset The offset in the file to write into.
+ * @return Negative value on error, size of the data written otherwise.
+ */
+static ssize_t vault_write(struct file *file, const char __user *user, size_t len, loff_t *offset)
+{
+	int nowait = !!(file->f_flags & O_NONBLOCK);
+	latency_t lat;
+	ssize_t ret;
+
+	latency_begin(&lat, file, 1);
+	ret = vault_write_request(file, user, len, offset, nowait, &lat);
+	latency_end(&lat);
+
+	return request_result(ret, nowait);
+}
+
+/**
+ * @brief Get the current segment of an iterator over buffers in userspace.
+ * @param iter The iterator.
+ * @param addr The address of the segment, set by this function.
+ * @return The length of the segment.
+ */
+static size_t iter_segment(const struct iov_iter *iter, void __user **addr)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+	*addr = iter_iov_addr(iter);
+	return iter_iov_len(iter);
+#else
+	struct iovec iov = iov_iter_iovec(iter);
+
+	*addr = iov.iov_base;
+	return iov.iov_len;
+#endif
+}
+
+/**
+ * @brief Check whether an iterator holds buffers in userspace.
+ * @param iter The iterator.
+ * @return Non-zero value if the buffers are in userspace.
+ */
+static int iter_user(const struct iov_iter *iter)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+	return user_backed_iter(iter);
+#else
+	return iter_is_iovec(iter);
+#endif
+}
+
+/**
+ * @brief Read or write a vault segment by segment of an iterator.
+ * @details The request ends at the first segment that is not transferred completely. Non-blocking requests that already transferred data return it instead of `-EAGAIN`.
+ * @param iocb The control block of the request.
+ * @param iter The buffers in userspace.
+ * @param write Specifies whether the request is a write.
+ * @return Negative value on error, size of the data read or written otherwise.
+ */
+static ssize_t vault_rw_iter(struct kiocb *iocb, struct iov_iter *iter, int write)
+{
+	struct file *file = iocb->ki_filp;
+	int nowait = (iocb->ki_flags & IOCB_NOWAIT) || (file->f_flags & O_NONBLOCK);
+	ssize_t done = 0, ret = 0;
+	void __user *addr;
+	latency_t lat;
+	size_t len;
+
+	if (!iter_user(iter))
+		return -EINVAL;
+
+	while (iov_iter_count(iter) > 0) {
+		len = iter_segment(iter, &addr);
+
+		latency_begin(&lat, file, write);
+
+		if (write)
+			ret = vault_write_request(file, addr, len, &iocb->ki_pos, nowait, &lat);
+		else
+			ret = vault_read_request(file, addr, len, &iocb->ki_pos, nowait, &lat);
+
+		latency_end(&lat);
+
+		if (ret <= 0)
+			break;
+
+		iov_iter_advance(iter, ret);
+		done += ret;
+
+		if (ret < len)
+			break;
+	}
+
+	return done > 0 ? done : request_result(ret, nowait);
+}
+
+/**
+ * @brief Handler for vectored and asynchronous reads of a vault.
+ * @details This function is called by `readv()`, `preadv2()` and io_uring. Requests with `RWF_NOWAIT` fail with `-EAGAIN` instead of waiting.
+ * @param iocb The control block of the request.
+ * @param to The buffers in userspace to read into.
+ * @return Negative value on error, size of the data read otherwise.
+ */
+static ssize_t vault_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	return vault_rw_iter(iocb, to, 0);
+}
+
+/**
+ * @brief Handler for vectored and asynchronous writes of a vault.
+ * @details This function is called by `writev()`, `pwritev2()` and io_uring. Requests with `RWF_NOWAIT` fail with `-EAGAIN` instead of waiting.
+ * @param iocb The control block of the request.
+ * @param from The buffers in userspace to write from.
+ * @return Negative value on error, size of the data written otherwise.
+ */
+static ssize_t vault_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	return vault_rw_iter(iocb, from, 1);
+}
+
+/**
+ * @brief Handler for polling a vault.
+ * @details The vault is ready for reading and writing while its lock is free, which is when non-blocking requests are most likely to succeed. Pollers are woken whenever the lock is released. Queue vaults are readable while a message is queued and writable while the queue is not full, and pollers are woken by every message enqueued or dequeued.
+ * @param file The file struct of the resource.
+ * @param wait The poll table to register with.
+ * @return The events the vault is ready for.
+ */
+static __poll_t vault_poll(struct file *file, poll_table *wait)
+{
+	unsigned long used;
+	vault_t *vault;
+	__poll_t mask;
+	int dev_idx;
+
+	dev_idx = MINOR(file->f_inode->i_rdev);
+	vault = &vaults[dev_idx];
+
+	poll_wait(file, &vault->poll_wait, wait);
+
+	if (READ_ONCE(vault->flags) & VAULT_QUEUE) {
+		used = queue_used(vault);
+		mask = used > 0 ? EPOLLIN | EPOLLRDNORM : 0;
+
+		if (used + QUEUE_HEADER < READ_ONCE(vault->size))
+			mask |= EPOLLOUT | EPOLLWRNORM;
+
+		return mask;
+	}
+
+	// Taking the lock here would run pending batches and wake all other pollers.
+	if (READ_ONCE(vault->locked))
+		return 0;
+
+	return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+}
+
+/**
+ * @brief Handler for duplicating a mapping of a vault.
+ * @param vma The new mapping.
+ */
+static void vault_vm_open(struct vm_area_struct *vma)
+{
+	vault_t *vault = vma->vm_private_data;
+
+	atomic_inc(&vault->mappings);
+}
+
+/**
+ * @brief Handler for unmapping a vault.
+ * @param vma The mapping that is removed.
+ */
+static void vault_vm_close(struct vm_area_struct *vma)
+{
+	vault_t *vault = vma->vm_private_data;
+
+	atomic_dec(&vault->mappings);
+}
+
+/**
+ * @brief The instructions of the vault mappings.
+ */
+static const struct vm_operations_struct vault_vm_ops = {
+	.open = vault_vm_open, ///< The handler for duplicated mappings.
+	.close = vault_vm_close, ///< The unmap handler.
+};
+
+/**
+ * @brief Map the encrypted data of a vault into userspace.
+ * @details This function is called whenever `mmap()` is called on a vault file descriptor. Only the owner of a mappable vault can map it, and the mapping is always read-only. The vault cannot be deleted while it is mapped.
+ * @param file The file struct of the resource.
+ * @param vma The mapping to set up.
+ * @return `0` on success, negative value otherwise.
+ */
+static int vault_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	vault_t *vault;
+	int dev_idx;
+	int errind;
+
+	dev_idx = MINOR(file->f_inode->i_rdev);
+	vault = &vaults[dev_idx];
+
+	if (file_partition(file) >= 0 || vault->owner != get_current_uid()) {
+		printk("User has no permission to map this secvault.\n");
+		return -EACCES;
+	}
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EACCES;
+
+	if (vault_lock_interruptible(vault))
+		return -ERESTARTSYS;
+
+	if (!vault->in_use || !(vault->flags & VAULT_MAPPABLE)) {
+		vault_unlock(vault);
+		return -EINVAL;
+	}
+
+	// Erased storage must not become visible through the mapping.
+	vault_scrub_range(vault, 0, vault->size);
+
+	errind = remap_vmalloc_range(vma, vault->data, vma->vm_pgoff);
+	if (errind) {
+		vault_unlock(vault);
+		return errind;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	vma->vm_ops = &vault_vm_ops;
+	vma->vm_private_data = vault;
+	vault_vm_open(vma);
+
+	vault_unlock(vault);
+
+	return 0;
+}
+
+/**
+ * @brief Read from a vault if it was modified since a known generation.
+ * @details If the generation of the caller is current, neither the lock nor the data of the vault are touched.
+ * @param vault The vault to read from.
+ * @param part_idx The index of the partition to read from, negative value for the whole vault.
+ * @param user The conditional read message in userspace.
+ * @return `0` if data was read, `VAULT_NOT_MODIFIED` if the generation is current, negative value otherwise.
+ */
+static long vault_cond_read(vault_t *vault, int part_idx, struct cond_read_t __user *user)
+{
+	struct cond_read_t msg;
+	region_t region;
+	loff_t offset;
+	ssize_t ret;
+
+	if (copy_from_user(&msg, user, sizeof(msg)))
+		return -EFAULT;
+
+	if (vault_region(vault, part_idx, get_current_uid(), &region))
+		return -EACCES;
+
+	if (msg.generation == atomic64_read(region.generation))
+		return VAULT_NOT_MODIFIED;
+
+	if (vault_lock_interruptible(vault))
+		return -ERESTARTSYS;
+
+	// Ownership might have changed in the meantime.
+	if (vault_region(vault, part_idx, get_current_uid(), &region)) {
+		vault_unlock(vault);
+		return -EACCES;
+	}
+
+	msg.generation = atomic64_read(region.generation);
+	offset = msg.offset;
+
+	ret = vault_read_locked(vault, &region, u64_to_user_ptr(msg.buffer), msg.len, &offset, 0, NULL);
+
+	vault_unlock(vault);
+
+	if (ret < 0)
+		return ret;
+
+	msg.len = ret;
+
+	if (copy_to_user(user, &msg, sizeof(msg)))
+		return -EFAULT;
+
+	return 0;
+}
+
+/**
+ * @brief Restrict an opened vault to one of its partitions.
+ * @details Only the owner of the partition can select it, and a file can only select one partition.
+ * @param vault The vault of the file.
+ * @param file The opened file.
+ * @param user The partition message in userspace.
+ * @return `0` on success, negative value otherwise.
+ */
+static long vault_select(vault_t *vault, struct file *file, struct part_msg_t __user *user)
+{
+	struct part_msg_t msg;
+	int part_idx;
+
+	if (copy_from_user(&msg, user, sizeof(msg)))
+		return -EFAULT;
+
+	if (memchr_inv(msg.pad, 0, sizeof(msg.pad)))
+		return -EINVAL;
+
+	msg.name[PARTNAME] = '\0';
+
+	if (vault_lock_interruptible(vault))
+		return -ERESTARTSYS;
+
+	if (file_partition(file) >= 0) {
+		vault_unlock(vault);
+		return -EBUSY;
+	}
+
+	part_idx = vault_find_partition(vault, msg.name);
+	if (part_idx < 0) {
+		vault_unlock(vault);
+		return -ENOENT;
+	}
+
+	if (vault->parts[part_idx].owner != get_current_uid()) {
+		printk("User has no permission to select this partition.\n");
+		vault_unlock(vault);
+		return -EACCES;
+	}
+
+	atomic_inc(&vault->parts[part_idx].users);
+	file->private_data = (void *)(long)(part_idx + 1);
+
+	vault_unlock(vault);
+
+	return 0;
+}
+
+/**
+ * @brief The handler for ioctl requests on a vault.
+ * @details Requests on the region of the file can be issued by its owner, all other requests only by the owner of the vault.
+ * @param file The file this handler was called from.
+ * @param cmd The command that was passed to the ioctl request.
+ * @param arg The arguments for this ioctl request.
+ * @return `0` on success, negative value otherwise.
+ */
+static long vault_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct key_msg_t key_msg;
+	struct vault_info_t info;
+	region_t region;
+	vault_t *vault;
+	int dev_idx;
+	long ret = 0;
+
+	dev_idx = MINOR(file->f_inode->i_rdev);
+	vault = &vaults[dev_idx];
+
+	switch (cmd) {
+	case VAULT_IOC_SELECT:
+		return vault_select(vault, file, (struct part_msg_t __user *)arg);
+	case VAULT_IOC_GET_INFO:
+		if (vault_region(vault, file_partition(file), get_current_uid(), &region))
+			return -EACCES;
+
+		// Fields are sampled without the lock, so they might be from different generations.
+		memset(&info, 0, sizeof(info));
+		info.generation = atomic64_read(region.generation);
+		info.size = READ_ONCE(region.size);
+		info.used_space = READ_ONCE(*region.used_space);
+
+		if (file_partition(file) < 0 && (READ_ONCE(vault->flags) & VAULT_QUEUE))
+			info.used_space = queue_used(vault);
+
+		if (copy_to_user((void __user *)arg, &info, sizeof(info)))
+			return -EFAULT;
+
+		return 0;
+	case VAULT_IOC_COND_READ:
+		return vault_cond_read(vault, file_partition(file), (struct cond_read_t __user *)arg);
+	}
+
+	if (file_partition(file) >= 0 || vault->owner != get_current_uid()) {
+		printk("User has no permission to control this secvault.\n");
+		return -EACCES;
+	}
+
+	if (vault_lock_interruptible(vault))
+		return -ERESTARTSYS;
+
+	switch (cmd) {
+	case VAULT_IOC_GET_KEY:
+		if (!vault->in_use || !(vault->flags & VAULT_MAPPABLE)) {
+			ret = -EINVAL;
+			break;
+		}
+
+		memset(&key_msg, 0, sizeof(key_msg));
+		key_msg.generation = atomic64_read(&vault->generation);
+		memcpy(key_msg.key, vault->key, KEYSIZE);
+
+		if (copy_to_user((void __user *)arg, &key_msg, sizeof(key_msg)))
+			ret = -EFAULT;
+
+		memset(&key_msg, 0, sizeof(key_msg));
+		break;
+	default:
+		ret = -ENOTTY;
+	}
+
+	vault_unlock(vault);
 
-static dev_t ioctl_number;
-static struct cdev *ioctl_driver;
-static struct device *ioctl_dev;
+	return ret;
+}
 
-static vault_t vaults[N_VAULTS];
+/**
+ * @brief The instructions of the vault devices.
+ */
+static struct file_operations vault_fops = {
+	.owner = THIS_MODULE, ///< The owner of this device.
+	.open = vault_open, ///< The open handler.
+	.release = vault_release, ///< The close handler.
+	.llseek = vault_llseek, ///< The seek handler.
+	.read = vault_read, ///< The read handler.
+	.write = vault_write, ///< The write handler.
+	.read_iter = vault_read_iter, ///< The handler of vectored and asynchronous reads.
+	.write_iter = vault_write_iter, ///< The handler of vectored and asynchronous writes.
+	.poll = vault_poll, ///< The poll handler.
+	.fsync = vault_fsync, ///< The handler committing the journal of persistent vaults.
+	.mmap = vault_mmap, ///< The mmap handler.
+	.unlocked_ioctl = vault_ioctl, ///< The ioctl handler.
+	.compat_ioctl = compat_ptr_ioctl, ///< The ioctl handler of 32-bit processes, which share the layout of all messages.
+};
 
 /**
- * @brief Reset a vault to default configuration.
- * @param vault The vault to reset.
+ * @brief Struct of a single target of a fan-out write in the kernel.
  */
-static void reset_vault(vault_t *vault)
+struct fanout_work {
+	struct work_struct work; ///< The work item to run the write on a worker.
+	const char *payload; ///< The plaintext to write, shared among all targets.
+	unsigned long len; ///< The length of the payload.
+	struct fanout_target_t *target; ///< The target to write to.
+	uid_t uid; ///< The user that issued the write.
+	u64 cgroup; ///< The cgroup of the task that issued the write.
+	int deferred; ///< Specifies whether the write runs on a worker.
+};
+
+/**
+ * @brief Write the payload of a fan-out write into one target.
+ * @details The payload is encrypted straight into the storage of the vault. Replicated vaults copy the result to the other nodes.
+ * @param work The work item of the target.
+ */
+static void fanout_write_one(struct work_struct *work)
 {
-	vault->in_use = 0;
-	vault->size = 0;
-	vault->used_space = 0;
-	vault->owner = -1;
+	struct fanout_work *fw = container_of(work, struct fanout_work, work);
+	struct fanout_target_t *target = fw->target;
+	vault_t *vault = &vaults[target->device];
+	unsigned long to_copy;
+	unsigned long start;
+	region_t region;
+	int part_idx = -1;
+	int node;
+	u64 begin;
 
-	if (vault->driver != NULL) {
-		cdev_del(vault->driver);
-		vault->driver = NULL;
+	vault_lock(vault);
+
+	if (!vault->in_use || vault->stripes != NULL || vault->blocks != NULL ||
+			(vault->flags & (VAULT_QUEUE | VAULT_PERSISTENT))) {
+		target->status = -EINVAL;
+		goto out;
 	}
 
-	if (vault->data != NULL) {
-		kfree(vault->data);
-		vault->data = NULL;
+	if (target->partition[0] != '\0') {
+		part_idx = vault_find_partition(vault, target->partition);
+		if (part_idx < 0) {
+			target->status = -ENOENT;
+			goto out;
+		}
+	}
+
+	if (vault_region(vault, part_idx, fw->uid, &region)) {
+		target->status = -EACCES;
+		goto out;
+	}
+
+	if (target->offset >= region.size) {
+		target->status = -EINVAL;
+		goto out;
+	}
+
+	to_copy = min(fw->len, region.size - target->offset);
+	start = region.start + target->offset;
+
+	vault_seq_begin(vault);
+	vault_scrub_range(vault, region.start, start + to_copy);
+
+	begin = ktime_get_ns();
+	xor_copy(vault->data + start, fw->payload, to_copy, target->offset, region.key);
+	cgroup_charge(fw->cgroup, begin, 1, fw->deferred);
+
+	if (vault->replicas != NULL) {
+		for_each_node(node) {
+			if (vault->replicas[node] != NULL && vault->replicas[node] != vault->data)
+				memcpy(vault->replicas[node] + start, vault->data + start, to_copy);
+		}
 	}
+
+	if (target->offset + to_copy > *region.used_space)
+		*region.used_space = target->offset + to_copy;
+
+	vault_seq_end(vault);
+
+	atomic64_inc(region.generation);
+	target->status = to_copy;
+
+out:
+	vault_unlock(vault);
 }
 
 /**
- * @brief Get the current user id.
+ * @brief Write one payload into a list of vaults.
+ * @details The payload is copied from userspace once. Large writes are spread across CPUs, small ones run in the caller. The status of each target is reported back.
+ * @param user The fan-out message in userspace.
+ * @return `0` on success, negative value otherwise. Failures of single targets are only reported in their status.
  */
-static uid_t get_current_uid(void)
+static long fanout_write(struct fanout_msg_t __user *user)
 {
-#if LINUX_VERSION_CODE <= KERNEL_VERSION(4,14,0)
-	kuid_t uid_wrapper = current_uid();
-	uid_t uid = __kuid_val(uid_wrapper);
-	return uid;
-#else
-	return 1;
-#endif
+	struct fanout_msg_t msg;
+	struct fanout_target_t *targets;
+	struct fanout_work *works;
+	bool parallel;
+	char *payload;
+	long ret = 0;
+	uid_t uid;
+	u64 cgroup;
+	int i;
+
+	if (copy_from_user(&msg, user, sizeof(msg)))
+		return -EFAULT;
+
+	if (msg.len < 1 || msg.len > MAX_DATA || msg.n_targets < 1 || msg.n_targets > MAX_FANOUT || msg.pad != 0)
+		return -EINVAL;
+
+	targets = memdup_user(u64_to_user_ptr(msg.targets), msg.n_targets * sizeof(*targets));
+	if (IS_ERR(targets))
+		return PTR_ERR(targets);
+
+	for (i = 0; i < msg.n_targets; i++) {
+		if (memchr_inv(targets[i].pad, 0, sizeof(targets[i].pad))) {
+			kfree(targets);
+			return -EINVAL;
+		}
+	}
+
+	payload = vmemdup_user(u64_to_user_ptr(msg.payload), msg.len);
+	if (IS_ERR(payload)) {
+		kfree(targets);
+		return PTR_ERR(payload);
+	}
+
+	works = kcalloc(msg.n_targets, sizeof(*works), GFP_KERNEL);
+	if (works == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	uid = get_current_uid();
+	cgroup = current_cgroup();
+	parallel = msg.n_targets > 1 && msg.len * msg.n_targets >= FANOUT_PARALLEL_MIN;
+
+	for (i = 0; i < msg.n_targets; i++) {
+		works[i].payload = payload;
+		works[i].len = msg.len;
+		works[i].target = &targets[i];
+		works[i].uid = uid;
+		works[i].cgroup = cgroup;
+		works[i].deferred = parallel;
+		INIT_WORK(&works[i].work, fanout_write_one);
+
+		targets[i].partition[PARTNAME] = '\0';
+
+		if (targets[i].device >= N_VAULTS) {
+			targets[i].status = -EINVAL;
+			continue;
+		}
+
+		if (parallel)
+			queue_work(class_wq[current_class()], &works[i].work);
+		else
+			fanout_write_one(&works[i].work);
+	}
+
+	if (parallel) {
+		for (i = 0; i < msg.n_targets; i++)
+			flush_work(&works[i].work);
+	}
+
+	if (copy_to_user(u64_to_user_ptr(msg.targets), targets, msg.n_targets * sizeof(*targets)))
+		ret = -EFAULT;
+
+	kfree(works);
+
+out:
+	kvfree_sensitive(payload, msg.len);
+	kfree(targets);
+
+	return ret;
 }
 
 /**
- * @brief Handler for opening a vault.
- * @details This function is called whenever `open()` is called on a vault file descriptor.
- * @param inode The inode of the resource.
- * @param file The file struct of the resource.
+ * @brief Add a partition to a vault.
+ * @details The partition is placed in the first gap of the vault that is large enough, and its storage is cleared.
+ * @param vault The vault to add the partition to. The caller has to hold its lock.
+ * @param msg The partition message.
  * @return `0` on success, negative value otherwise.
  */
-static int vault_open(struct inode *inode, struct file *file)
+static long partition_add(vault_t *vault, struct part_msg_t *msg)
 {
-	vault_t *vault;
-	int dev_idx = MINOR(inode->i_rdev);
+	partition_t *part = NULL;
+	unsigned long start = 0;
+	int i, moved;
 
-	vault = &vaults[dev_idx];
+	if (msg->name[0] == '\0' || msg->size < 1 || msg->size > vault->size ||
+			vault->stripes != NULL || vault->blocks != NULL || (vault->flags & (VAULT_QUEUE | VAULT_PERSISTENT)))
+		return -EINVAL;
 
-	if (vault->owner != get_current_uid()) {
-		printk("User has no permission to open this secvault.\n");
-		return -EACCES;
+	if (vault_find_partition(vault, msg->name) >= 0)
+		return -EEXIST;
+
+	for (i = 0; i < MAX_PARTITIONS && part == NULL; i++) {
+		if (!vault->parts[i].in_use)
+			part = &vault->parts[i];
 	}
 
+	if (part == NULL)
+		return -ENOSPC;
+
+	// Move the candidate behind every partition it overlaps until it fits.
+	do {
+		moved = 0;
+
+		for (i = 0; i < MAX_PARTITIONS; i++) {
+			partition_t *other = &vault->parts[i];
+
+			if (!other->in_use)
+				continue;
+
+			if (start < other->start + other->size && other->start < start + msg->size) {
+				start = other->start + other->size;
+				moved = 1;
+			}
+		}
+	} while (moved && start + msg->size <= vault->size);
+
+	if (start + msg->size > vault->size)
+		return -ENOSPC;
+
+	vault_seq_begin(vault);
+	vault_clear(vault, start, msg->size);
+	memcpy(part->name, msg->name, PARTNAME + 1);
+	memcpy(part->key, msg->key, KEYSIZE);
+	part->start = start;
+	part->size = msg->size;
+	part->used_space = 0;
+	part->owner = msg->owner;
+	atomic_set(&part->users, 0);
+	atomic64_inc(&part->generation);
+	part->in_use = 1;
+	vault_seq_end(vault);
+
 	return 0;
 }
 
 /**
- * @brief Handler for closing a vault.
- * @details This function is called whenever `close()` is called on a vault file descriptor.
- * @param inode The inode of the resource.
- * @param file The file struct of the resource.
+ * @brief Remove a partition from a vault.
+ * @details The storage of the partition is cleared. Partitions cannot be removed while files have them selected.
+ * @param vault The vault to remove the partition from. The caller has to hold its lock.
+ * @param msg The partition message.
  * @return `0` on success, negative value otherwise.
  */
-static int vault_release(struct inode *inode, struct file *file)
+static long partition_del(vault_t *vault, struct part_msg_t *msg)
 {
-	vault_t *vault;
-	int dev_idx = MINOR(inode->i_rdev);
+	partition_t *part;
+	int part_idx;
 
-	vault = &vaults[dev_idx];
+	part_idx = vault_find_partition(vault, msg->name);
+	if (part_idx < 0)
+		return -ENOENT;
 
-	if (vault->owner != get_current_uid()) {
-		printk("User has no permission to release this secvault.\n");
-		return -EACCES;
-	}
+	part = &vault->parts[part_idx];
+
+	if (atomic_read(&part->users) > 0)
+		return -EBUSY;
+
+	vault_seq_begin(vault);
+	part->in_use = 0;
+	part->used_space = 0;
+	vault_clear(vault, part->start, part->size);
+	vault_seq_end(vault);
+
+	atomic64_inc(&part->generation);
 
 	return 0;
 }
 
 /**
- * @brief Handler for seeking a vault.
- * @details This function is called whenever `seek()` is called on a vault file descriptor.
- * @param file The file struct of the resource.
- * @param offset The offset to seek.
- * @param whence The mode for seeking the file.
- * @return The new absolute offset in the file.
+ * @brief Handle the partition requests on the ioctl device.
+ * @details Only the owner of a vault can manage its partitions.
+ * @param cmd The command that was passed to the ioctl request.
+ * @param user The partition message in userspace.
+ * @return `0` on success, negative value otherwise.
  */
-static loff_t vault_llseek(struct file *file, loff_t offset, int whence)
+static long partition_ioctl(unsigned int cmd, struct part_msg_t __user *user)
 {
+	struct part_msg_t msg;
 	vault_t *vault;
-	loff_t new_offset;
-	int dev_idx;
+	long ret;
 
-	dev_idx = MINOR(file->f_inode->i_rdev);
-	vault = &vaults[dev_idx];
+	if (copy_from_user(&msg, user, sizeof(msg)))
+		return -EFAULT;
 
-	if (vault->owner != get_current_uid()) {
-		printk("User has no permission to seek this secvault.\n");
-		return -EACCES;
+	if (memchr_inv(msg.pad, 0, sizeof(msg.pad)))
+		return -EINVAL;
+
+	msg.name[PARTNAME] = '\0';
+	msg.key[KEYSIZE] = '\0';
+
+	if (msg.device >= N_VAULTS) {
+		printk("Specified secvault does not exist.\n");
+		return -EINVAL;
 	}
 
-	if (down_interruptible(&vault->sem)) {
-		up(&vault->sem);
+	vault = &vaults[msg.device];
+
+	if (vault_lock_interruptible(vault))
 		return -ERESTARTSYS;
-	}
 
-	switch (whence) {
-	case SEEK_SET:
-		new_offset = offset;
-		break;
-	case SEEK_CUR:
-		new_offset = file->f_pos + offset;
-		break;
-	case SEEK_END:
-		new_offset = vault->size - 1 - offset;
-		break;
-	default:
-		up(&vault->sem);
+	if (!vault->in_use) {
+		printk("Secvault was not yet created.\n");
+		vault_unlock(vault);
 		return -EINVAL;
 	}
 
-	if (new_offset < 0 || new_offset >= vault->size) {
-		up(&vault->sem);
-		return -EINVAL;
+	if (vault->owner != get_current_uid()) {
+		printk("User not granted access due to missing permission.\n");
+		vault_unlock(vault);
+		return -EACCES;
 	}
 
-	file->f_pos = new_offset;
+	if (cmd == SV_CTL_ADD_PARTITION)
+		ret = partition_add(vault, &msg);
+	else
+		ret = partition_del(vault, &msg);
 
-	up(&vault->sem);
+	vault_unlock(vault);
 
-	return new_offset;
+	memset(&msg, 0, sizeof(msg));
+
+	return ret;
 }
 
 /**
- * @brief Encrypt or decrypt a buffer using xor operation.
- * @details This function is used to encrypt and decrypt the vaults of the module.
- * @param buffer The buffer to apply this operation on.
- * @param len The length of the buffer.
- * @param offset The offset of the encryption cursor in the buffer.
- * @param key The key to encrypt the buffer with.
+ * @brief Compare a block of two vaults.
+ * @details If both vaults use the same key and encoding, the encrypted data is compared directly, and blocks of deduplicated vaults that were never written in both are equal without reading them. Otherwise both blocks are decrypted first.
+ * @param a The first vault.
+ * @param b The second vault.
+ * @param offset The offset of the block, a multiple of `DIFF_BLOCK`.
+ * @param len The length of the block.
+ * @param buf_a The buffer for the block of the first vault.
+ * @param buf_b The buffer for the block of the second vault.
+ * @return `1` if the blocks are equal, `0` otherwise.
  */
-static void xor_buffer(char *buffer, size_t len, loff_t offset, char key[KEYSIZE])
+static int diff_block(vault_t *a, vault_t *b, unsigned long offset, unsigned long len, char *buf_a, char *buf_b)
 {
-	int i, key_idx;
+	int same_cipher = memcmp(a->key, b->key, KEYSIZE) == 0 && (a->blocks == NULL) == (b->blocks == NULL);
+	u64 start;
 
-	for (i = 0; i < len; i++) {
-		key_idx = (offset + i) % KEYSIZE;
-		buffer[i] ^= key[key_idx];
+	if (same_cipher && a->blocks != NULL &&
+			a->blocks[offset / DIFF_BLOCK] == NULL && b->blocks[offset / DIFF_BLOCK] == NULL)
+		return 1;
+
+	vault_load(a, offset, buf_a, len);
+	vault_load(b, offset, buf_b, len);
+
+	if (!same_cipher) {
+		// Deduplicated vaults encrypt every block from its start.
+		start = ktime_get_ns();
+		xor_buffer(buf_a, len, a->blocks != NULL ? 0 : offset, a->key);
+		xor_buffer(buf_b, len, b->blocks != NULL ? 0 : offset, b->key);
+		cgroup_charge(current_cgroup(), start, 1, 0);
 	}
+
+	return memcmp(buf_a, buf_b, len) == 0;
 }
 
 /**
- * @brief Read data from a secure vault.
- * @details Data is first copied into an internal buffer, decrypted and then copied to userspace.
- * @param file The file the read from.
- * @param user The buffer in userspace to read into.
- * @param len The length of the buffer to read into.
- * @param offset The offset in the file to read from.
- * @return Negative value on error, size of the data read otherwise.
+ * @brief Get the ranges in which two vaults differ.
+ * @details The used space of both vaults is compared in blocks of `DIFF_BLOCK` bytes, and adjacent differing blocks are merged. Data that only one of the vaults holds differs. The caller must hold the locks of both vaults and their stripes.
+ * @param a The first vault.
+ * @param b The second vault.
+ * @param ranges The buffer for the ranges, large enough for `MAX_DIFF_RANGES`.
+ * @param buf_a A buffer of `DIFF_BLOCK` bytes.
+ * @param buf_b Another buffer of `DIFF_BLOCK` bytes.
+ * @param compared The number of bytes compared.
+ * @return The number of differing ranges.
  */
-static ssize_t vault_read(struct file *file, char __user *user, size_t len, loff_t *offset)
+static unsigned int vault_diff(vault_t *a, vault_t *b, struct diff_range_t *ranges, char *buf_a, char *buf_b,
+		u64 *compared)
 {
-	vault_t *vault;
-	size_t not_copied;
-	size_t len_avail;
-	size_t to_copy;
-	int dev_idx;
-	char *buffer;
-
-	dev_idx = MINOR(file->f_inode->i_rdev);
-	vault = &vaults[dev_idx];
-
-	if (vault->owner != get_current_uid()) {
-		printk("User has no permission to read this secvault.\n");
-		return -EACCES;
-	}
-
-	if (down_interruptible(&vault->sem)) {
-		up(&vault->sem);
-		return -ERESTARTSYS;
-	}
+	unsigned long used = max(a->used_space, b->used_space);
+	unsigned long common = min(a->used_space, b->used_space);
+	unsigned long pos, len;
+	unsigned int n = 0;
 
-	len_avail = vault->used_space - *offset;
+	for (pos = 0; pos < used; pos += DIFF_BLOCK) {
+		len = min_t(unsigned long, DIFF_BLOCK, used - pos);
 
-	if (len_avail < len)
-		to_copy = len_avail;
-	else
-		to_copy = len;
+		if (pos + len <= common && diff_block(a, b, pos, len, buf_a, buf_b))
+			continue;
 
-	buffer = kmalloc(to_copy * sizeof(char), GFP_KERNEL);
-	if (buffer == NULL) {
-		printk("Could not allocate memory to read secvault.\n");
-		up(&vault->sem);
-		return -ENOMEM;
+		if (n > 0 && ranges[n - 1].offset + ranges[n - 1].len == pos) {
+			ranges[n - 1].len += len;
+		} else {
+			ranges[n].offset = pos;
+			ranges[n].len = len;
+			n++;
+		}
 	}
 
-	memcpy(buffer, vault->data + *offset, to_copy);
-
-	xor_buffer(buffer, to_copy, *offset, vault->key);
-
-	not_copied = copy_to_user(user, buffer, to_copy);
-
-	kfree(buffer);
-
-	*offset += to_copy - not_copied;
-
-	up(&vault->sem);
+	*compared = used;
 
-	return to_copy - not_copied;
+	return n;
 }
 
 /**
- * @brief Write data from a secure vault.
- * @details Data is first copied into an internal buffer from userspace, encrypted and then copied to the vault.
- * @param file The file the write into.
- * @param user The buffer in userspace to read from.
- * @param len The length of the buffer to read from.
- * @param offset The offset in the file to write into.
- * @return Negative value on error, size of the data written otherwise.
+ * @brief Handle a diff request on the ioctl device.
+ * @details The caller has to own both vaults. The vaults are locked in the order of their ids, so concurrent diffs cannot deadlock.
+ * @param user The diff message in userspace.
+ * @return `0` on success, negative value otherwise.
  */
-static ssize_t vault_write(struct file *file, const char __user *user, size_t len, loff_t *offset)
+static long diff_ioctl(struct diff_msg_t __user *user)
 {
-	vault_t *vault;
-	size_t not_copied;
-	size_t len_avail;
-	size_t to_copy;
-	size_t max_written;
-	int dev_idx;
-	char *buffer;
+	struct diff_range_t *ranges;
+	struct diff_msg_t msg;
+	vault_t *first, *second;
+	char *buf_a, *buf_b;
+	long ret = 0;
 
-	dev_idx = MINOR(file->f_inode->i_rdev);
-	vault = &vaults[dev_idx];
-
-	if (vault->owner != get_current_uid()) {
-		printk("User has no permission to write secvault.\n");
-		return -EACCES;
-	}
+	if (copy_from_user(&msg, user, sizeof(msg)))
+		return -EFAULT;
 
-	if (down_interruptible(&vault->sem)) {
-		up(&vault->sem);
-		return -ERESTARTSYS;
+	if (msg.device >= N_VAULTS || msg.other >= N_VAULTS || msg.device == msg.other) {
+		printk("Specified secvaults are invalid.\n");
+		return -EINVAL;
 	}
 
-	len_avail = vault->size - *offset;
+	first = &vaults[min(msg.device, msg.other)];
+	second = &vaults[max(msg.device, msg.other)];
 
-	if (len_avail < len)
-		to_copy = len_avail;
-	else
-		to_copy = len;
+	ranges = kcalloc(MAX_DIFF_RANGES, sizeof(struct diff_range_t), GFP_KERNEL);
+	buf_a = kmalloc(DIFF_BLOCK, GFP_KERNEL);
+	buf_b = kmalloc(DIFF_BLOCK, GFP_KERNEL);
+	if (ranges == NULL || buf_a == NULL || buf_b == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
-	buffer = kmalloc(to_copy * sizeof(char), GFP_KERNEL);
-	if (buffer == NULL) {
-		printk("Could not allocate memory to write secvault.\n");
-		up(&vault->sem);
-		return -ENOMEM;
+	if (vault_lock_foreground(first)) {
+		ret = -ERESTARTSYS;
+		goto out;
+	}
+
+	if (vault_lock_foreground(second)) {
+		vault_unlock(first);
+		ret = -ERESTARTSYS;
+		goto out;
 	}
 
-	not_copied = copy_from_user(buffer, user, to_copy);
+	if (!first->in_use || !second->in_use) {
+		printk("Secvault was not yet created.\n");
+		ret = -EINVAL;
+	} else if (first->owner != get_current_uid() || second->owner != get_current_uid()) {
+		printk("User not granted access due to missing permission.\n");
+		ret = -EACCES;
+	} else if ((first->flags | second->flags) & VAULT_QUEUE) {
+		printk("Queue secvaults cannot be compared.\n");
+		ret = -EINVAL;
+	}
 
-	xor_buffer(buffer, to_copy, *offset, vault->key);
+	if (ret == 0) {
+		stripe_lock_all(first);
+		stripe_lock_all(second);
 
-	// Calculate new possible used_space.
-	max_written = *offset + to_copy - not_copied;
+		msg.n_ranges = vault_diff(&vaults[msg.device], &vaults[msg.other], ranges, buf_a, buf_b, &msg.compared);
 
-	if (max_written > vault->used_space)
-		vault->used_space = max_written;
+		stripe_unlock_all(second);
+		stripe_unlock_all(first);
+	}
 
-	memcpy(vault->data + *offset, buffer, to_copy);
+	vault_unlock(second);
+	vault_unlock(first);
 
-	kfree(buffer);
+	if (ret)
+		goto out;
 
-	*offset += to_copy - not_copied;
+	if (copy_to_user(u64_to_user_ptr(msg.ranges), ranges, min(msg.n_ranges, msg.max_ranges) * sizeof(struct diff_range_t)) ||
+			copy_to_user(user, &msg, sizeof(msg)))
+		ret = -EFAULT;
 
-	up(&vault->sem);
+out:
+	kfree(ranges);
+	kfree_sensitive(buf_a);
+	kfree_sensitive(buf_b);
 
-	return to_copy - not_copied;
+	return ret;
 }
 
-/**
- * @brief The instructions of the vault devices.
- */
-static struct file_operations vault_fops = {
-	.owner = THIS_MODULE, ///< The owner of this device.
-	.open = vault_open, ///< The open handler.
-	.release = vault_release, ///< The close handler.
-	.llseek = vault_llseek, ///< The seek handler.
-	.read = vault_read, ///< The read handler.
-	.write = vault_write, ///< The write handler.
-};
-
 /**
  * @brief The handler for incoming ioctl requests.
  * @details This function will parse the request and handle specified instructions.
@@ -356,16 +5158,31 @@ static struct file_operations vault_fops = {
  */
 static long ioctl_handler(struct file *file, unsigned int cmd, unsigned long arg)
 {
+	unsigned long used_space;
+	unsigned int flags;
 	int errind;
+	int i;
 	vault_t *vault;
-	struct cdev *sv_driver;
+	journal_rec_t *rec;
 
 	struct msg_t msg;
 
+	if (cmd == SV_CTL_FANOUT)
+		return fanout_write((struct fanout_msg_t __user *)arg);
+
+	if (cmd == SV_CTL_ADD_PARTITION || cmd == SV_CTL_DEL_PARTITION)
+		return partition_ioctl(cmd, (struct part_msg_t __user *)arg);
+
+	if (cmd == SV_CTL_DIFF)
+		return diff_ioctl((struct diff_msg_t __user *)arg);
+
 	errind = copy_from_user(&msg, (void *)arg, sizeof(struct msg_t));
 	if (errind < 0)
 		return -EINVAL;
 
+	if (memchr_inv(msg.pad, 0, sizeof(msg.pad)))
+		return -EINVAL;
+
 	msg.key[KEYSIZE] = '\0';
 
 	if (msg.device >= N_VAULTS) {
@@ -375,61 +5192,84 @@ static long ioctl_handler(struct file *file, unsigned int cmd, unsigned long arg
 
 	vault = &vaults[msg.device];
 
-	if (down_interruptible(&vault->sem)) {
-		up(&vault->sem);
+	if (vault_lock_interruptible(vault))
 		return -ERESTARTSYS;
-	}
 
 	switch (cmd) {
 	case 0:
 		// Handle initialization.
-		printk("Creating new secvault %d, size %ld, key '%s'.\n", msg.device, msg.size, msg.key);
+		printk("Creating new secvault %d, size %llu, key '%s'.\n", msg.device, msg.size, msg.key);
 
 		if (vault->in_use) {
 			printk("Specified secvault was already created.\n");
-			up(&vault->sem);
+			vault_unlock(vault);
 			return -EINVAL;
 		}
 
 		if (msg.size < 1 || msg.size > MAX_DATA) {
 			printk("Secvault size is invalid.\n");
-			up(&vault->sem);
+			vault_unlock(vault);
 			return -EINVAL;
 		}
 
-		sv_driver = cdev_alloc();
-		if (sv_driver == NULL) {
-			printk("Allocating driver object failed.\n");
-			up(&vault->sem);
+		if ((msg.flags & ~(VAULT_REPLICATED | VAULT_MAPPABLE | VAULT_STRIPED | VAULT_DEDUP | VAULT_QUEUE |
+				VAULT_PERSISTENT)) || hweight32(msg.flags) > 1) {
+			printk("Secvault flags are invalid.\n");
+			vault_unlock(vault);
 			return -EINVAL;
 		}
 
-		cdev_init(sv_driver, &vault_fops);
-		sv_driver->owner = THIS_MODULE;
-		vault->driver = sv_driver;
+		if ((msg.flags & VAULT_QUEUE) && msg.size <= QUEUE_HEADER) {
+			printk("Secvault size is too small for a queue.\n");
+			vault_unlock(vault);
+			return -EINVAL;
+		}
 
-		errind = cdev_add(sv_driver, vault->number, 1);
-		if (errind) {
-			printk("Adding cdev failed.\n");
-			up(&vault->sem);
+		if ((msg.flags & VAULT_STRIPED) && (!is_power_of_2(msg.stripe_size) || msg.stripe_size < STRIPE_MIN ||
+				DIV_ROUND_UP(msg.size, msg.stripe_size) > MAX_STRIPES)) {
+			printk("Secvault stripe size is invalid.\n");
+			vault_unlock(vault);
 			return -EINVAL;
 		}
 
-		vault->data = kmalloc(msg.size * sizeof(char), GFP_KERNEL);
+		vault->flags = msg.flags;
 
-		if (vault->data == NULL) {
+		if (msg.flags & VAULT_STRIPED)
+			vault->stripe_shift = ilog2(msg.stripe_size);
+
+		if (vault_alloc_data(vault, msg.size)) {
 			printk("Could not allocate memory for secvault data.\n");
-			up(&vault->sem);
+			vault->flags = 0;
+			vault_unlock(vault);
 			return -ENOMEM;
 		}
 
+		used_space = 0;
+
+		if (msg.flags & VAULT_PERSISTENT) {
+			vault->size = msg.size;
+			errind = persist_open(vault, msg.device, &used_space);
+
+			if (errind) {
+				printk("Could not open persisted secvault.\n");
+				vault_free_data(vault);
+				vault->size = 0;
+				vault->flags = 0;
+				vault_unlock(vault);
+				return errind;
+			}
+		}
+
+		vault_seq_begin(vault);
 		vault->in_use = 1;
 		vault->size = msg.size;
-		vault->used_space = 0;
+		vault->used_space = used_space;
 		vault->owner = get_current_uid();
 
 		memcpy(vault->key, msg.key, KEYSIZE);
-		memset(vault->data, 0, vault->size);
+		vault_seq_end(vault);
+
+		atomic64_inc(&vault->generation);
 
 		break;
 	case 1:
@@ -438,17 +5278,31 @@ static long ioctl_handler(struct file *file, unsigned int cmd, unsigned long arg
 
 		if (!vault->in_use) {
 			printk("Secvault was not yet created.\n");
-			up(&vault->sem);
+			vault_unlock(vault);
 			return -EINVAL;
 		}
 
 		if (vault->owner != get_current_uid()) {
 			printk("User not granted access due to missing permission.\n");
-			up(&vault->sem);
+			vault_unlock(vault);
 			return -EACCES;
 		}
 
+		stripe_lock_all(vault);
+		queue_lock_all(vault);
+
+		// Queued messages must stay readable, as they are consumed by other processes.
+		if (vault->flags & VAULT_QUEUE)
+			queue_rekey(vault, msg.key);
+
+		vault_seq_begin(vault);
 		memcpy(vault->key, msg.key, KEYSIZE);
+		vault_seq_end(vault);
+
+		queue_unlock_all(vault);
+		stripe_unlock_all(vault);
+
+		atomic64_inc(&vault->generation);
 
 		break;
 	case 5:
@@ -457,18 +5311,47 @@ static long ioctl_handler(struct file *file, unsigned int cmd, unsigned long arg
 
 		if (!vault->in_use) {
 			printk("Secvault was not yet created.\n");
-			up(&vault->sem);
+			vault_unlock(vault);
 			return -EINVAL;
 		}
 
 		if (vault->owner != get_current_uid()) {
 			printk("User not granted access due to missing permission.\n");
-			up(&vault->sem);
+			vault_unlock(vault);
 			return -EACCES;
 		}
 
+		rec = journal_alloc(vault, 0, 0);
+		if (IS_ERR(rec)) {
+			vault_unlock(vault);
+			return PTR_ERR(rec);
+		}
+
+		stripe_lock_all(vault);
+		queue_lock_all(vault);
+
+		vault_seq_begin(vault);
 		vault->used_space = 0;
-		memset(vault->data, 0, vault->size);
+		vault_erase_data(vault);
+
+		for (i = 0; i < MAX_PARTITIONS; i++) {
+			if (vault->parts[i].in_use)
+				vault->parts[i].used_space = 0;
+		}
+
+		vault_seq_end(vault);
+
+		journal_log(vault, rec, JOURNAL_ERASE, 0, 0);
+
+		queue_unlock_all(vault);
+		stripe_unlock_all(vault);
+
+		atomic64_inc(&vault->generation);
+
+		for (i = 0; i < MAX_PARTITIONS; i++) {
+			if (vault->parts[i].in_use)
+				atomic64_inc(&vault->parts[i].generation);
+		}
 
 		break;
 	case 3:
@@ -477,26 +5360,51 @@ static long ioctl_handler(struct file *file, unsigned int cmd, unsigned long arg
 
 		if (!vault->in_use) {
 			printk("Secvault was not yet created.\n");
-			up(&vault->sem);
+			vault_unlock(vault);
 			return -EINVAL;
 		}
 
 		if (vault->owner != get_current_uid()) {
 			printk("User not granted access due to missing permission.\n");
-			up(&vault->sem);
+			vault_unlock(vault);
 			return -EACCES;
 		}
 
+		if (atomic_read(&vault->mappings) > 0) {
+			printk("Secvault is still mapped.\n");
+			vault_unlock(vault);
+			return -EBUSY;
+		}
+
+		for (i = 0; i < MAX_PARTITIONS; i++) {
+			if (atomic_read(&vault->parts[i].users) > 0) {
+				printk("Partition of secvault is still selected.\n");
+				vault_unlock(vault);
+				return -EBUSY;
+			}
+		}
+
+		// Producers and consumers check that the vault is in use while holding their locks.
+		queue_lock_all(vault);
+		flags = vault->flags;
+
+		persist_close(vault);
 		reset_vault(vault);
+		atomic64_inc(&vault->generation);
+
+		if (flags & VAULT_QUEUE) {
+			up(&vault->queue_consume);
+			up(&vault->queue_produce);
+		}
 
 		break;
 	default:
 		printk("Received unknown ioctl 0x%x.\n", cmd);
-		up(&vault->sem);
+		vault_unlock(vault);
 		return -EINVAL;
 	}
 
-	up(&vault->sem);
+	vault_unlock(vault);
 
 	return 0;
 }
@@ -507,8 +5415,387 @@ static long ioctl_handler(struct file *file, unsigned int cmd, unsigned long arg
 static struct file_operations ioctl_fops = {
 	.owner = THIS_MODULE, ///< The owner of the device.
 	.unlocked_ioctl = ioctl_handler, ///< The ioctl handler.
+	.compat_ioctl = compat_ptr_ioctl, ///< The ioctl handler of 32-bit processes, which share the layout of all messages.
+};
+
+/**
+ * @brief Print the statistics of all vaults.
+ * @details This function backs the `stats` file in the debugfs directory of the module.
+ * @param seq The sequence file to print into.
+ * @param unused Unused.
+ * @return `0` on success, negative value otherwise.
+ */
+static int stats_show(struct seq_file *seq, void *unused)
+{
+	vault_t *vault;
+	cgroup_usage_t *usage;
+	struct cgroup_time time;
+	int i, j, node, bkt;
+
+	seq_printf(seq, "memory: storage %ld allocations %ld\n",
+			atomic_long_read(&storage_bytes), atomic_long_read(&storage_allocs));
+
+	seq_printf(seq, "governor: mode %s share %u idle %u%% foreground %lu/s budget_ns %lld throttled %ld backlog %lu\n",
+			READ_ONCE(governor.accelerated) ? "accelerated" : "throttled", READ_ONCE(bg_share),
+			READ_ONCE(governor.idle_pct), READ_ONCE(governor.fg_rate),
+			atomic64_read(&governor.budget_ns), atomic_long_read(&governor.throttled), governor_backlog());
+
+	seq_printf(seq, "zerocopy: requests %ld fallbacks %ld min %u\n",
+			atomic_long_read(&zerocopy_requests), atomic_long_read(&zerocopy_fallbacks), READ_ONCE(zerocopy_min));
+
+	seq_printf(seq, "nowait: requests %ld busy %ld\n",
+			atomic_long_read(&nowait_requests), atomic_long_read(&nowait_busy));
+
+	seq_printf(seq, "spares: hits %ld misses %ld depth %u\n",
+			atomic_long_read(&spare_hits), atomic_long_read(&spare_misses), READ_ONCE(spare_depth));
+
+	for (i = 0; i < SPARE_CLASSES; i++) {
+		if (READ_ONCE(spare_pools[i].wanted))
+			seq_printf(seq, "  class %lu: spares %u\n", 1UL << (SPARE_MIN_SHIFT + i),
+					READ_ONCE(spare_pools[i].count));
+	}
+
+	for (i = 0; i < N_VAULTS; i++) {
+		vault = &vaults[i];
+
+		if (vault_lock_interruptible(vault))
+			return -ERESTARTSYS;
+
+		seq_printf(seq, "vault %d: in_use %d size %lu used %lu flags 0x%x generation %lld\n",
+				i, vault->in_use, vault->size, vault->used_space, vault->flags,
+				atomic64_read(&vault->generation));
+
+		for (j = 0; j < MAX_PARTITIONS; j++) {
+			partition_t *part = &vault->parts[j];
+
+			if (part->in_use)
+				seq_printf(seq, "  partition %s: start %lu size %lu used %lu owner %u users %d\n",
+						part->name, part->start, part->size, part->used_space,
+						part->owner, atomic_read(&part->users));
+		}
+
+		if (vault->replicas != NULL) {
+			for_each_node(node) {
+				if (vault->replicas[node] != NULL)
+					seq_printf(seq, "  node %d: hits %ld\n", node,
+							atomic_long_read(&vault->node_hits[node]));
+			}
+
+			seq_printf(seq, "  remote: reads %ld\n", atomic_long_read(&vault->remote_reads));
+		}
+
+		seq_printf(seq, "  combining: requests %lu batches %lu\n", vault->combined, vault->batches);
+		seq_printf(seq, "  scrub: pending 0x%lx yields %lu\n", vault->scrub_pending, vault->scrub_yields);
+		seq_printf(seq, "  lockless: fallbacks %ld\n", atomic_long_read(&vault->seq_fallbacks));
+
+		if (vault->stripes != NULL)
+			seq_printf(seq, "  stripes: count %u size %lu users %d\n", vault->n_stripes,
+					1UL << vault->stripe_shift, atomic_read(&vault->stripe_users));
+
+		if (vault->journal != NULL)
+			seq_printf(seq, "  journal: logged %llu committed %llu commits %lu records %lu checkpoints %lu\n",
+					vault->journal_seq, vault->journal_committed, vault->journal_commits,
+					vault->journal_records, vault->journal_checkpoints);
+
+		if (vault->flags & VAULT_QUEUE)
+			seq_printf(seq, "  queue: bytes %lu sent %lu received %lu\n", queue_used(vault),
+					READ_ONCE(vault->queue_sent), READ_ONCE(vault->queue_received));
+
+		if (vault->blocks != NULL)
+			seq_printf(seq, "  dedup: blocks %lu stored %lu ratio %lu.%02lu\n", vault->dedup_mapped,
+					vault->dedup_stored,
+					vault->dedup_stored ? vault->dedup_mapped / vault->dedup_stored : 0,
+					vault->dedup_stored ? vault->dedup_mapped * 100 / vault->dedup_stored % 100 : 0);
+
+		vault_unlock(vault);
+	}
+
+	rcu_read_lock();
+	hash_for_each_rcu(cgroup_usage, bkt, usage, node) {
+		cgroup_sum_time(usage, &time);
+		seq_printf(seq, "cgroup %llu: transform_ns %llu deferred_ns %llu\n", usage->id,
+				time.transform_ns, time.deferred_ns);
+	}
+	rcu_read_unlock();
+
+	cgroup_sum_time(&cgroup_other, &time);
+	seq_printf(seq, "cgroup other: transform_ns %llu deferred_ns %llu\n",
+			time.transform_ns, time.deferred_ns);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+/**
+ * @brief Names of the phases of a request, indexed by `enum latency_phase`.
+ */
+static const char *const phase_names[N_PHASES] = { "lock", "alloc", "copy", "transform", "total" };
+
+/**
+ * @brief Get a percentile of a latency histogram.
+ * @param hist The buckets of the histogram.
+ * @param samples The number of samples in the histogram.
+ * @param pct The percentile to get.
+ * @return The upper bound in nanoseconds of the bucket holding the percentile.
+ */
+static u64 latency_percentile(const unsigned long *hist, unsigned long samples, unsigned int pct)
+{
+	unsigned long rank = DIV_ROUND_UP(samples * pct, 100);
+	unsigned long seen = 0;
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += hist[i];
+
+		if (seen >= rank)
+			break;
+	}
+
+	return 1ULL << min(i, LATENCY_BUCKETS - 1);
+}
+
+/**
+ * @brief Show the latency histograms of all vaults.
+ * @details This function backs the `latency` file in the debugfs directory of the module. Every line holds one phase of the reads or writes of a vault that has samples, with the number of samples, the median and 99th percentile, and the non-empty buckets as pairs of upper bound in nanoseconds and count.
+ * @param seq The file to write into.
+ * @param unused Unused private data.
+ * @return Always `0`.
+ */
+static int latency_show(struct seq_file *seq, void *unused)
+{
+	unsigned long hist[LATENCY_BUCKETS];
+	unsigned long samples;
+	int i, write, phase, b;
+
+	for (i = 0; i < N_VAULTS; i++) {
+		for (write = 0; write < 2; write++) {
+			for (phase = 0; phase < N_PHASES; phase++) {
+				samples = 0;
+
+				for (b = 0; b < LATENCY_BUCKETS; b++) {
+					hist[b] = atomic_long_read(&vaults[i].latency[write][phase][b]);
+					samples += hist[b];
+				}
+
+				if (samples == 0)
+					continue;
+
+				seq_printf(seq, "vault %d %s %s: samples %lu p50 %llu p99 %llu buckets", i,
+						write ? "write" : "read", phase_names[phase], samples,
+						latency_percentile(hist, samples, 50), latency_percentile(hist, samples, 99));
+
+				for (b = 0; b < LATENCY_BUCKETS; b++) {
+					if (hist[b] > 0)
+						seq_printf(seq, " %llu:%lu", 1ULL << b, hist[b]);
+				}
+
+				seq_puts(seq, "\n");
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Open the latency histograms.
+ * @param inode The inode of the resource.
+ * @param file The file struct of the resource.
+ * @return `0` on success, negative value otherwise.
+ */
+static int latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, latency_show, inode->i_private);
+}
+
+/**
+ * @brief Clear the latency histograms of all vaults.
+ * @details This function is called whenever the `latency` file is written, regardless of the data written.
+ * @param file The file struct of the resource.
+ * @param user The buffer in userspace to read from.
+ * @param len The length of the buffer.
+ * @param offset The offset in the file.
+ * @return The length of the buffer.
+ */
+static ssize_t latency_reset(struct file *file, const char __user *user, size_t len, loff_t *offset)
+{
+	int i, write, phase, b;
+
+	for (i = 0; i < N_VAULTS; i++) {
+		for (write = 0; write < 2; write++) {
+			for (phase = 0; phase < N_PHASES; phase++) {
+				for (b = 0; b < LATENCY_BUCKETS; b++)
+					atomic_long_set(&vaults[i].latency[write][phase][b], 0);
+			}
+		}
+	}
+
+	return len;
+}
+
+/**
+ * @brief The instructions of the latency file.
+ */
+static const struct file_operations latency_fops = {
+	.owner = THIS_MODULE, ///< The owner of the file.
+	.open = latency_open, ///< The open handler.
+	.read = seq_read, ///< The read handler.
+	.write = latency_reset, ///< The write handler, clearing the histograms.
+	.llseek = seq_lseek, ///< The seek handler.
+	.release = single_release, ///< The release handler.
+};
+
+/**
+ * @brief Fill the record of a vault.
+ * @details The lock of the vault is not taken. The fields changed together on creation and deletion are sampled while the sequence counter of the vault is stable, the counters are sampled individually.
+ * @param vault The vault to describe.
+ * @param id The id of the vault.
+ * @param record The record to fill.
+ */
+static void vault_record(vault_t *vault, unsigned int id, struct vault_record_t *record)
+{
+	unsigned int seq;
+	int i;
+
+	memset(record, 0, sizeof(*record));
+	record->id = id;
+
+	do {
+		seq = vault_seq_wait(vault);
+
+		record->in_use = READ_ONCE(vault->in_use);
+		record->flags = READ_ONCE(vault->flags);
+		record->owner = READ_ONCE(vault->owner);
+		record->size = READ_ONCE(vault->size);
+		record->used_space = READ_ONCE(vault->used_space);
+	} while (read_seqcount_retry(&vault->seq, seq));
+
+	if (record->flags & VAULT_QUEUE)
+		record->used_space = queue_used(vault);
+
+	record->generation = atomic64_read(&vault->generation);
+	record->storage = READ_ONCE(vault->data_bytes);
+	record->mappings = atomic_read(&vault->mappings);
+	record->combined = READ_ONCE(vault->combined);
+	record->batches = READ_ONCE(vault->batches);
+	record->lockless_fallbacks = atomic_long_read(&vault->seq_fallbacks);
+	record->scrub_pending = READ_ONCE(vault->scrub_pending);
+	record->dedup_blocks = READ_ONCE(vault->dedup_mapped);
+	record->dedup_stored = READ_ONCE(vault->dedup_stored);
+	record->queue_sent = READ_ONCE(vault->queue_sent);
+	record->queue_received = READ_ONCE(vault->queue_received);
+
+	for (i = 0; i < MAX_PARTITIONS; i++)
+		record->partitions += READ_ONCE(vault->parts[i].in_use) ? 1 : 0;
+}
+
+/**
+ * @brief Read the records of the vaults.
+ * @details This function backs the `vaults` file in the debugfs directory of the module. Whole records are returned starting at the record the offset points to, so all vaults can be read in one call without taking any lock or formatting text.
+ * @param file The file struct of the resource.
+ * @param user The buffer in userspace to read into.
+ * @param len The length of the buffer.
+ * @param offset The offset in the file, a multiple of the record size.
+ * @return Size of the records read, negative value on error.
+ */
+static ssize_t records_read(struct file *file, char __user *user, size_t len, loff_t *offset)
+{
+	struct vault_record_t record;
+	size_t done = 0;
+	loff_t id;
+
+	if (*offset % sizeof(record) != 0)
+		return -EINVAL;
+
+	for (id = *offset / sizeof(record); id < N_VAULTS && len - done >= sizeof(record); id++) {
+		vault_record(&vaults[id], id, &record);
+
+		if (copy_to_user(user + done, &record, sizeof(record)))
+			return done > 0 ? done : -EFAULT;
+
+		done += sizeof(record);
+		*offset += sizeof(record);
+	}
+
+	if (done == 0 && id < N_VAULTS)
+		return -EINVAL;
+
+	return done;
+}
+
+/**
+ * @brief The instructions of the records file.
+ */
+static const struct file_operations records_fops = {
+	.owner = THIS_MODULE, ///< The owner of the file.
+	.read = records_read, ///< The read handler.
+	.llseek = default_llseek, ///< The seek handler.
 };
 
+/**
+ * @brief Remove the drivers of all vaults.
+ */
+static void del_vault_drivers(void)
+{
+	int i;
+
+	for (i = 0; i < N_VAULTS; i++) {
+		if (vaults[i].driver != NULL) {
+			cdev_del(vaults[i].driver);
+			vaults[i].driver = NULL;
+		}
+	}
+}
+
+/**
+ * @brief Add the drivers of all vaults.
+ * @details The drivers stay registered while the module is loaded, so creating a vault does not have to add one. Opening a vault that is not in use fails, as nobody owns it.
+ * @return `0` on success, negative value otherwise.
+ */
+static int add_vault_drivers(void)
+{
+	struct cdev *sv_driver;
+	int i;
+
+	for (i = 0; i < N_VAULTS; i++) {
+		sv_driver = cdev_alloc();
+		if (sv_driver == NULL) {
+			printk("Allocating driver object failed.\n");
+			del_vault_drivers();
+			return -EIO;
+		}
+
+		cdev_init(sv_driver, &vault_fops);
+		sv_driver->owner = THIS_MODULE;
+
+		if (cdev_add(sv_driver, vaults[i].number, 1)) {
+			printk("Adding cdev failed.\n");
+			kobject_put(&sv_driver->kobj);
+			del_vault_drivers();
+			return -EIO;
+		}
+
+		vaults[i].driver = sv_driver;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Destroy the worker pools of the priority classes.
+ */
+static void destroy_class_wq(void)
+{
+	int i;
+
+	for (i = 0; i < N_CLASSES; i++) {
+		if (class_wq[i] != NULL) {
+			destroy_workqueue(class_wq[i]);
+			class_wq[i] = NULL;
+		}
+	}
+}
+
 /**
  * @brief Entry point of the module.
  * @details This method is called when the module is loaded. It will set up all requried resources.
@@ -519,7 +5806,43 @@ static int __init mod_init(void)
 	int i;
 	vault_t *vault;
 
+	// The chunks of a vault are tracked in a single word.
+	BUILD_BUG_ON(DIV_ROUND_UP(MAX_DATA, SCRUB_CHUNK) >= BITS_PER_LONG);
+
+	// The messages must not depend on the word size, see compat_ptr_ioctl().
+	BUILD_BUG_ON(sizeof(struct msg_t) != 40);
+	BUILD_BUG_ON(sizeof(struct key_msg_t) != 24);
+	BUILD_BUG_ON(sizeof(struct vault_info_t) != 24);
+	BUILD_BUG_ON(sizeof(struct cond_read_t) != 32);
+	BUILD_BUG_ON(sizeof(struct part_msg_t) != 48);
+	BUILD_BUG_ON(sizeof(struct fanout_target_t) != 40);
+	BUILD_BUG_ON(sizeof(struct fanout_msg_t) != 32);
+	BUILD_BUG_ON(sizeof(struct diff_msg_t) != 32);
+	BUILD_BUG_ON(sizeof(struct vault_record_t) != 120);
+
+	class_wq[CLASS_INTERACTIVE] = alloc_workqueue("secvault_interactive", WQ_HIGHPRI, interactive_workers);
+	class_wq[CLASS_BULK] = alloc_workqueue("secvault_bulk", WQ_UNBOUND | WQ_SYSFS, bulk_workers);
+	class_wq[CLASS_BACKGROUND] = alloc_workqueue("secvault_background", WQ_UNBOUND | WQ_SYSFS | WQ_FREEZABLE, background_workers);
+
+	for (i = 0; i < N_CLASSES; i++) {
+		if (class_wq[i] == NULL) {
+			printk("Allocating worker pools failed.\n");
+			destroy_class_wq();
+			return -ENOMEM;
+		}
+	}
+
 	memset(&vaults, 0, sizeof(vaults));
+	cgroup_other.time = &cgroup_other_time;
+
+	BUILD_BUG_ON((1UL << (SPARE_MIN_SHIFT + SPARE_CLASSES - 1)) != MAX_DATA);
+
+	for (i = 0; i < SPARE_CLASSES; i++)
+		spin_lock_init(&spare_pools[i].lock);
+
+	INIT_DELAYED_WORK(&spare_work, spare_fill);
+	INIT_DELAYED_WORK(&governor.work, governor_run);
+	atomic64_set(&governor.budget_ns, div_u64(jiffies_to_nsecs(GOV_INTERVAL) * min(bg_share, 100U), 100));
 
 	for (i = 0; i < N_VAULTS; i++) {
 		vault = &vaults[i];
@@ -527,10 +5850,27 @@ static int __init mod_init(void)
 		vault->driver = NULL;
 		vault->number = MKDEV(MAJOR_NUM, i);
 		vault->in_use = 0;
+		vault->owner = -1;
 		sema_init(&vault->sem, 1);
+		init_llist_head(&vault->pending);
+		init_waitqueue_head(&vault->combine_wait);
+		init_waitqueue_head(&vault->poll_wait);
+		sema_init(&vault->queue_produce, 1);
+		sema_init(&vault->queue_consume, 1);
+		INIT_DELAYED_WORK(&vault->scrub_work, vault_scrub);
+		seqcount_init(&vault->seq);
+		init_waitqueue_head(&vault->stripe_wait);
+		mutex_init(&vault->journal_mutex);
+		spin_lock_init(&vault->journal_lock);
+		INIT_LIST_HEAD(&vault->journal_pending);
+		INIT_WORK(&vault->journal_work, journal_flush);
 	}
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+	driver_class = class_create("secvault");
+#else
 	driver_class = class_create(THIS_MODULE, "secvault");
+#endif
 
 	// Register devices numbers.
 
@@ -538,6 +5878,7 @@ static int __init mod_init(void)
 	errind = register_chrdev_region(dev_numbers, 1 + N_VAULTS, MODNAME);
 	if (errind < 0) {
 		printk("Registering chrdev failed.\n");
+		destroy_class_wq();
 		return -EIO;
 	}
 
@@ -549,6 +5890,7 @@ static int __init mod_init(void)
 	if (ioctl_driver == NULL) {
 		printk("Allocating driver object failed.\n");
 		unregister_chrdev_region(dev_numbers, 1 + N_VAULTS);
+		destroy_class_wq();
 		return -EIO;
 	}
 
@@ -560,11 +5902,29 @@ static int __init mod_init(void)
 		printk("Adding cdev failed.\n");
 		kobject_put(&ioctl_driver->kobj);
 		unregister_chrdev_region(dev_numbers, 1 + N_VAULTS);
+		destroy_class_wq();
 		return -EIO;
 	}
 
 	ioctl_dev = device_create(driver_class, NULL, ioctl_number, NULL, "%s", "ioctl");
 
+	// Create vault devices.
+
+	if (add_vault_drivers()) {
+		device_destroy(driver_class, ioctl_number);
+		cdev_del(ioctl_driver);
+		unregister_chrdev_region(dev_numbers, 1 + N_VAULTS);
+		destroy_class_wq();
+		return -EIO;
+	}
+
+	// Expose statistics, failure is not fatal.
+
+	debugfs_dir = debugfs_create_dir(MODNAME, NULL);
+	debugfs_create_file("stats", 0400, debugfs_dir, NULL, &stats_fops);
+	debugfs_create_file("vaults", 0400, debugfs_dir, NULL, &records_fops);
+	debugfs_create_file("latency", 0600, debugfs_dir, NULL, &latency_fops);
+
 	return 0;
 }
 
@@ -577,13 +5937,24 @@ static void __exit mod_exit(void)
 	int i;
 	vault_t *vault;
 
+	debugfs_remove_recursive(debugfs_dir);
+
 	// Cleanup vaults.
 
 	for (i = 0; i < N_VAULTS; i++) {
 		vault = &vaults[i];
+		cancel_delayed_work_sync(&vault->scrub_work);
+		persist_close(vault);
 		reset_vault(vault);
 	}
 
+	del_vault_drivers();
+	cancel_delayed_work_sync(&spare_work);
+	cancel_delayed_work_sync(&governor.work);
+	destroy_class_wq();
+	spare_free_all();
+	cgroup_free_usage();
+
 	// Cleanup ioctl device.
 
 	device_destroy(driver_class, ioctl_number);
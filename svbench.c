@@ -0,0 +1,1960 @@
+/**
+ * @file
+ * @author eikendev
+ * @date 2018-01-16
+ * @brief This module contains the benchmark program for the kernel module.
+ * @details Each benchmark creates its own vaults on the specified ids and deletes them afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <limits.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+
+#include <sys/ioctl.h>
+
+#include "common.h"
+#include "svlib.h"
+#include "transform.h"
+
+/**
+ * @brief The path where the ioctl device can be found.
+ */
+#define SV_CTL "/dev/sv_ctl"
+
+/**
+ * @brief The key used for all benchmark vaults.
+ */
+#define BENCH_KEY "benchmark"
+
+/**
+ * @brief The smallest record size to benchmark.
+ */
+#define MIN_RECORD 16
+
+/**
+ * @brief The amount of data to process per record size.
+ */
+#define BENCH_BYTES (64UL << 20)
+
+/**
+ * @brief The path of the statistics of the kernel module.
+ */
+#define STATS_PATH "/sys/kernel/debug/secvault/stats"
+
+/**
+ * @brief The path of the module parameter setting the threshold of zero-copy requests.
+ */
+#define ZEROCOPY_PARAM "/sys/module/secvault/parameters/zerocopy_min"
+
+/**
+ * @brief The path of the module parameter setting the sampling interval of latency measurements.
+ */
+#define LATENCY_PARAM "/sys/module/secvault/parameters/latency_sample"
+
+/**
+ * @brief The path of the latency histograms of the kernel module.
+ */
+#define LATENCY_PATH "/sys/kernel/debug/secvault/latency"
+
+/**
+ * @brief The factor between the record sizes of the latency benchmark.
+ */
+#define LATENCY_STEP 16
+
+/**
+ * @brief The number of calls of each ioctl of the ioctl benchmark.
+ */
+#define IOCTL_OPS 1000000
+
+/**
+ * @brief The size of the payload of the fan-out ioctl of the ioctl benchmark.
+ */
+#define IOCTL_PAYLOAD 16
+
+/**
+ * @brief The number of threads writing the whole vault in the non-blocking benchmark.
+ */
+#define NOWAIT_WRITERS 4
+
+/**
+ * @brief The size of the records read by the event loop of the non-blocking benchmark, large enough to take the lock.
+ */
+#define NOWAIT_RECORD 4096
+
+/**
+ * @brief The number of records read by the event loop of the non-blocking benchmark.
+ */
+#define NOWAIT_READS 20000
+
+/**
+ * @brief The size of the queue vault of the queue benchmark.
+ */
+#define QUEUE_SIZE 65536
+
+/**
+ * @brief The largest message size of the queue benchmark.
+ */
+#define QUEUE_MESSAGE 1024
+
+/**
+ * @brief The number of messages passed per message size in the queue benchmark.
+ */
+#define QUEUE_OPS 100000
+
+/**
+ * @brief The number of passes over all vaults of the records benchmark.
+ */
+#define RECORDS_PASSES 20000
+
+/**
+ * @brief The amount of data written per record size and mode of the persistence benchmark.
+ */
+#define PERSIST_BYTES (32UL << 20)
+
+/**
+ * @brief The number of threads of the persistence benchmark that wait for durability concurrently.
+ */
+#define PERSIST_THREADS 8
+
+/**
+ * @brief The smallest record size of the zero-copy benchmark.
+ */
+#define ZEROCOPY_RECORD 4096
+
+/**
+ * @brief The default duration of the soak benchmark in seconds.
+ */
+#define SOAK_DURATION 3600
+
+/**
+ * @brief The interval between two samples of the soak benchmark in seconds.
+ */
+#define SOAK_INTERVAL 10
+
+/**
+ * @brief The number of samples to skip before looking for trends.
+ */
+#define SOAK_WARMUP 3
+
+/**
+ * @brief The growth of slab usage per hour that is reported as a leak.
+ */
+#define SOAK_SLAB_GROWTH (1L << 20)
+
+/**
+ * @brief The growth of the unusable free space index per hour that is reported as fragmentation.
+ */
+#define SOAK_FRAG_GROWTH 0.02
+
+/**
+ * @brief The smallest buddy order that counts as usable free memory.
+ */
+#define SOAK_FRAG_ORDER 3
+
+/**
+ * @brief The size of the records of the combining benchmark.
+ */
+#define COMBINE_RECORD 64
+
+/**
+ * @brief The maximum number of threads of the combining benchmark.
+ */
+#define COMBINE_THREADS 64
+
+/**
+ * @brief The number of writes and reads of each thread of the combining benchmark.
+ */
+#define COMBINE_OPS 20000
+
+/**
+ * @brief The size of the record of the hot read benchmark.
+ */
+#define HOT_RECORD 32
+
+/**
+ * @brief The size of the records of the striping benchmark, also used as stripe size.
+ */
+#define STRIPE_RECORD 16384
+
+/**
+ * @brief The number of writes and reads of each thread of the striping benchmark.
+ */
+#define STRIPE_OPS 2000
+
+/**
+ * @brief The largest number of distinct blocks written by the deduplication benchmark.
+ */
+#define DEDUP_DISTINCT (MAX_DATA / DEDUP_BLOCK)
+
+/**
+ * @brief The largest record size of the multi-buffer transform benchmark.
+ */
+#define LANES_RECORD 256
+
+/**
+ * @brief The number of records transformed per lane count and record size.
+ */
+#define LANES_OPS 4000000
+
+/**
+ * @brief Struct of a thread of the combining, hot read and striping benchmarks.
+ */
+typedef struct {
+	pthread_t thread; ///< The thread.
+	unsigned int vault_id; ///< The id of the vault to access.
+	unsigned int slot; ///< The index of the record the thread owns.
+	int failed; ///< Specifies whether the thread read back wrong data.
+} worker_t;
+
+/**
+ * @brief Struct of a sample of the soak benchmark.
+ */
+typedef struct {
+	double hours; ///< The time of the sample since the start.
+	double slab; ///< The number of bytes in active slab objects.
+	double frag; ///< The unusable free space index for `SOAK_FRAG_ORDER`.
+	long storage; ///< The number of bytes allocated for vault storage by the module.
+	long allocs; ///< The number of vaults with storage allocated by the module.
+} sample_t;
+
+/**
+ * @brief The name of the program.
+ */
+static char *progname;
+
+/**
+ * @brief The file descriptor of the ioctl device.
+ */
+static int ctl_fd = -1;
+
+/**
+ * @brief Specifies whether the writers of the non-blocking benchmark keep running.
+ */
+static volatile int nowait_running;
+
+/**
+ * @brief The record size of the writers of the persistence benchmark.
+ */
+static size_t persist_record;
+
+/**
+ * @brief Print a usage message.
+ * @details The function terminates the program with the value `EXIT_FAILURE`.
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s <benchmark> <secvault id> [<seconds>]\n", progname);
+	fprintf(stderr, "       %s lanes\n", progname);
+	fprintf(stderr, "  mapped  compare read() with userspace decryption of a mapped secvault.\n");
+	fprintf(stderr, "  soak    run random secvault lifecycles and track memory growth, for an hour by default.\n");
+	fprintf(stderr, "  combine measure small reads and writes of many threads on one secvault.\n");
+	fprintf(stderr, "  hotread measure many threads reading the same small record of one secvault.\n");
+	fprintf(stderr, "  striped compare threads writing and reading their own records of a plain and a striped secvault.\n");
+	fprintf(stderr, "  dedup   measure a deduplicated secvault holding few to only distinct blocks.\n");
+	fprintf(stderr, "  lanes   compare the multi-buffer transform across lane counts, without a secvault.\n");
+	fprintf(stderr, "  zerocopy compare large reads and writes through a kernel buffer and through pinned user pages.\n");
+	fprintf(stderr, "  ioctl   measure the round trip of ioctls, to compare 64-bit and 32-bit builds.\n");
+	fprintf(stderr, "  nowait  compare blocking and non-blocking reads of an event loop while threads write the secvault.\n");
+	fprintf(stderr, "  queue   compare passing messages through a queue secvault with write, read and erase.\n");
+	fprintf(stderr, "  records compare collecting the counters of all secvaults from their records and from the statistics.\n");
+	fprintf(stderr, "  persist compare writes to a secvault in memory and to a persistent one, with and without fsync().\n");
+	fprintf(stderr, "  latency break the latency of reads and writes of several record sizes down into their phases.\n");
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Terminate the program with an error message.
+ * @param what The operation that failed.
+ */
+static void die(const char *what)
+{
+	fprintf(stderr, "[%s] ERROR: %s failed: %s\n", progname, what, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Get the current time of the monotonic clock.
+ * @return The current time in nanoseconds.
+ */
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Create a vault for benchmarking.
+ * @param vault_id The id of the vault to create.
+ * @param size The size of the vault.
+ * @param flags The flags to create the vault with.
+ * @param stripe_size The size of the stripes of a striped vault.
+ */
+static void bench_create(unsigned int vault_id, unsigned long size, unsigned int flags, unsigned long stripe_size)
+{
+	struct msg_t msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.device = vault_id;
+	msg.size = size;
+	msg.flags = flags;
+	msg.stripe_size = stripe_size;
+	memcpy(msg.key, BENCH_KEY, sizeof(BENCH_KEY));
+
+	if (ioctl(ctl_fd, 0, &msg) == -1)
+		die("create");
+}
+
+/**
+ * @brief Delete a vault created for benchmarking.
+ * @param vault_id The id of the vault to delete.
+ */
+static void bench_delete(unsigned int vault_id)
+{
+	struct msg_t msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.device = vault_id;
+
+	if (ioctl(ctl_fd, 3, &msg) == -1)
+		die("delete");
+}
+
+/**
+ * @brief Open the device of a vault.
+ * @param vault_id The id of the vault to open.
+ * @return The file descriptor of the vault.
+ */
+static int bench_open(unsigned int vault_id)
+{
+	char path[32];
+	int fd;
+
+	snprintf(path, sizeof(path), "/dev/sv_data%u", vault_id);
+
+	fd = open(path, O_RDWR);
+	if (fd < 0)
+		die("open");
+
+	return fd;
+}
+
+/**
+ * @brief Fill the whole vault with pseudo-random data.
+ * @param fd The file descriptor of the vault.
+ * @param size The size of the vault.
+ */
+static void bench_fill(int fd, size_t size)
+{
+	char *buffer = malloc(size);
+	size_t i;
+
+	if (buffer == NULL)
+		die("malloc");
+
+	for (i = 0; i < size; i++)
+		buffer[i] = rand();
+
+	if (pwrite(fd, buffer, size, 0) != (ssize_t)size)
+		die("write");
+
+	free(buffer);
+}
+
+/**
+ * @brief Get the number of iterations to run for a record size.
+ * @param record The record size.
+ * @return The number of iterations.
+ */
+static unsigned long bench_iterations(size_t record)
+{
+	unsigned long n = BENCH_BYTES / record;
+
+	return n > 1000000 ? 1000000 : n;
+}
+
+/**
+ * @brief Compare the in-kernel read path with userspace decryption.
+ * @details For every record size from `MIN_RECORD` to `MAX_DATA`, the same records are read with `pread()` and from the mapping.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_mapped(unsigned int vault_id)
+{
+	struct sv_mapping map;
+	uint64_t start, kernel_ns, user_ns;
+	unsigned long i, n;
+	size_t record;
+	char *expected, *buffer;
+	int fd;
+
+	bench_create(vault_id, MAX_DATA, VAULT_MAPPABLE, 0);
+	fd = bench_open(vault_id);
+	bench_fill(fd, MAX_DATA);
+
+	if (sv_map(fd, MAX_DATA, &map) == -1)
+		die("map");
+
+	expected = malloc(MAX_DATA);
+	buffer = malloc(MAX_DATA);
+	if (expected == NULL || buffer == NULL)
+		die("malloc");
+
+	printf("%10s %14s %12s %14s %12s\n", "record", "kernel ns/op", "kernel MB/s", "user ns/op", "user MB/s");
+
+	for (record = MIN_RECORD; record <= MAX_DATA; record *= 4) {
+		n = bench_iterations(record);
+
+		if (pread(fd, expected, record, 0) != (ssize_t)record)
+			die("read");
+
+		sv_read_mapped(&map, buffer, record, 0);
+
+		if (memcmp(expected, buffer, record) != 0) {
+			fprintf(stderr, "[%s] ERROR: mapped data differs from read data\n", progname);
+			exit(EXIT_FAILURE);
+		}
+
+		start = now_ns();
+		for (i = 0; i < n; i++) {
+			if (pread(fd, buffer, record, 0) != (ssize_t)record)
+				die("read");
+		}
+		kernel_ns = now_ns() - start;
+
+		start = now_ns();
+		for (i = 0; i < n; i++)
+			sv_read_mapped(&map, buffer, record, 0);
+		user_ns = now_ns() - start;
+
+		printf("%10zu %14.1f %12.1f %14.1f %12.1f\n", record,
+				(double)kernel_ns / n, (double)record * n * 1000 / kernel_ns,
+				(double)user_ns / n, (double)record * n * 1000 / user_ns);
+	}
+
+	free(expected);
+	free(buffer);
+	sv_unmap(&map);
+	close(fd);
+	bench_delete(vault_id);
+}
+
+/**
+ * @brief Set a numeric module parameter.
+ * @param path The path of the parameter.
+ * @param value The new value.
+ * @return The previous value.
+ */
+static unsigned long param_set(const char *path, unsigned long value)
+{
+	unsigned long old;
+	FILE *f;
+
+	f = fopen(path, "r+");
+	if (f == NULL)
+		die(path);
+
+	if (fscanf(f, "%lu", &old) != 1)
+		die(path);
+
+	rewind(f);
+	fprintf(f, "%lu\n", value);
+
+	if (fclose(f) != 0)
+		die(path);
+
+	return old;
+}
+
+/**
+ * @brief Compare reads and writes through a kernel buffer with zero-copy requests.
+ * @details For every record size from `ZEROCOPY_RECORD` to `MAX_DATA`, records are written and read back once with zero-copy requests disabled and once with all requests served from the pinned user pages. The crossover is a good value for the `zerocopy_min` parameter, which is restored afterwards.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_zerocopy(unsigned int vault_id)
+{
+	uint64_t start, elapsed[2];
+	unsigned long i, n, old;
+	char *record, *buffer;
+	size_t size;
+	int failed = 0;
+	int fd, pinned;
+
+	record = malloc(MAX_DATA);
+	buffer = malloc(MAX_DATA);
+	if (record == NULL || buffer == NULL)
+		die("malloc");
+
+	for (i = 0; i < MAX_DATA; i++)
+		record[i] = rand();
+
+	bench_create(vault_id, MAX_DATA, 0, 0);
+	fd = bench_open(vault_id);
+
+	old = param_set(ZEROCOPY_PARAM, 0);
+
+	printf("%10s %14s %14s\n", "record", "copy MB/s", "pinned MB/s");
+
+	for (size = ZEROCOPY_RECORD; size <= MAX_DATA; size *= 2) {
+		n = bench_iterations(size) / 4;
+
+		for (pinned = 0; pinned < 2; pinned++) {
+			param_set(ZEROCOPY_PARAM, pinned ? 1 : 0);
+
+			start = now_ns();
+
+			for (i = 0; i < n; i++) {
+				if (pwrite(fd, record, size, 0) != (ssize_t)size)
+					die("write");
+
+				if (pread(fd, buffer, size, 0) != (ssize_t)size)
+					die("read");
+			}
+
+			elapsed[pinned] = now_ns() - start;
+
+			failed |= memcmp(record, buffer, size) != 0;
+		}
+
+		printf("%10zu %14.1f %14.1f\n", size,
+				2.0 * size * n * 1000 / elapsed[0], 2.0 * size * n * 1000 / elapsed[1]);
+	}
+
+	param_set(ZEROCOPY_PARAM, old);
+
+	close(fd);
+	bench_delete(vault_id);
+
+	free(record);
+	free(buffer);
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: read back data that was not written\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Print the latency histograms of a vault.
+ * @param vault_id The id of the vault.
+ */
+static void latency_print(unsigned int vault_id)
+{
+	char line[1024], prefix[32];
+	FILE *f;
+
+	snprintf(prefix, sizeof(prefix), "vault %u ", vault_id);
+
+	f = fopen(LATENCY_PATH, "r");
+	if (f == NULL)
+		die("open " LATENCY_PATH);
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, prefix, strlen(prefix)) == 0)
+			printf("  %s", line + strlen(prefix));
+	}
+
+	fclose(f);
+}
+
+/**
+ * @brief Clear the latency histograms of all vaults.
+ */
+static void latency_reset(void)
+{
+	int fd = open(LATENCY_PATH, O_WRONLY);
+
+	if (fd < 0 || write(fd, "0\n", 2) != 2)
+		die("reset " LATENCY_PATH);
+
+	close(fd);
+}
+
+/**
+ * @brief Break the latency of reads and writes down into their phases.
+ * @details Every request is measured while the benchmark runs. For record sizes from `MIN_RECORD` to `MAX_DATA`, records are written and read back, and the histograms of the lock, allocation, copy and transform phases are printed. The `latency_sample` parameter is restored afterwards.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_latency(unsigned int vault_id)
+{
+	unsigned long i, n, old;
+	char *record, *buffer;
+	size_t size;
+	int failed = 0;
+	int fd;
+
+	record = malloc(MAX_DATA);
+	buffer = malloc(MAX_DATA);
+	if (record == NULL || buffer == NULL)
+		die("malloc");
+
+	for (i = 0; i < MAX_DATA; i++)
+		record[i] = rand();
+
+	bench_create(vault_id, MAX_DATA, 0, 0);
+	fd = bench_open(vault_id);
+
+	old = param_set(LATENCY_PARAM, 1);
+
+	for (size = MIN_RECORD; size <= MAX_DATA; size *= LATENCY_STEP) {
+		n = bench_iterations(size) / 16;
+
+		latency_reset();
+
+		for (i = 0; i < n; i++) {
+			if (pwrite(fd, record, size, 0) != (ssize_t)size)
+				die("write");
+
+			if (pread(fd, buffer, size, 0) != (ssize_t)size)
+				die("read");
+		}
+
+		failed |= memcmp(record, buffer, size) != 0;
+
+		printf("record %zu, %lu writes and reads:\n", size, n);
+		latency_print(vault_id);
+	}
+
+	param_set(LATENCY_PARAM, old);
+
+	close(fd);
+	bench_delete(vault_id);
+
+	free(record);
+	free(buffer);
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: read back data that was not written\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Measure the round trip of the ioctls of the vault and control devices.
+ * @details Each ioctl is called `IOCTL_OPS` times with the same message: querying the information of a vault, a conditional read that finds the generation current, and a fan-out write of a small payload to one target. The latter two pass user pointers inside the message, so running the benchmark built with `make svbench32` shows the cost of the compat path.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_ioctl(unsigned int vault_id)
+{
+	char payload[IOCTL_PAYLOAD], buffer[IOCTL_PAYLOAD];
+	struct fanout_target_t target;
+	struct fanout_msg_t fanout;
+	struct vault_info_t info;
+	struct cond_read_t cond;
+	uint64_t start, elapsed;
+	unsigned long i;
+	int fd;
+
+	bench_create(vault_id, 4096, 0, 0);
+	fd = bench_open(vault_id);
+
+	memset(payload, 'i', sizeof(payload));
+	if (pwrite(fd, payload, sizeof(payload), 0) != sizeof(payload))
+		die("write");
+
+	printf("abi %zu-bit\n", sizeof(void *) * 8);
+	printf("%10s %14s\n", "ioctl", "ns/op");
+
+	start = now_ns();
+	for (i = 0; i < IOCTL_OPS; i++) {
+		if (ioctl(fd, VAULT_IOC_GET_INFO, &info) == -1)
+			die("ioctl");
+	}
+	elapsed = now_ns() - start;
+
+	printf("%10s %14.1f\n", "info", (double)elapsed / IOCTL_OPS);
+
+	memset(&cond, 0, sizeof(cond));
+	cond.generation = info.generation;
+
+	start = now_ns();
+	for (i = 0; i < IOCTL_OPS; i++) {
+		cond.buffer = (uintptr_t)buffer;
+		cond.len = sizeof(buffer);
+		cond.offset = 0;
+
+		if (ioctl(fd, VAULT_IOC_COND_READ, &cond) != VAULT_NOT_MODIFIED)
+			die("ioctl");
+	}
+	elapsed = now_ns() - start;
+
+	printf("%10s %14.1f\n", "condread", (double)elapsed / IOCTL_OPS);
+
+	memset(&fanout, 0, sizeof(fanout));
+	memset(&target, 0, sizeof(target));
+	target.device = vault_id;
+	fanout.payload = (uintptr_t)payload;
+	fanout.len = sizeof(payload);
+	fanout.targets = (uintptr_t)&target;
+	fanout.n_targets = 1;
+
+	start = now_ns();
+	for (i = 0; i < IOCTL_OPS; i++) {
+		if (ioctl(ctl_fd, SV_CTL_FANOUT, &fanout) == -1 || target.status != sizeof(payload))
+			die("fanout");
+	}
+	elapsed = now_ns() - start;
+
+	printf("%10s %14.1f\n", "fanout", (double)elapsed / IOCTL_OPS);
+
+	close(fd);
+	bench_delete(vault_id);
+}
+
+/**
+ * @brief Write the whole vault repeatedly.
+ * @details This is the entry point of each writer of the non-blocking benchmark, which keeps the lock of the vault busy.
+ * @param arg The worker of the thread.
+ * @return `NULL`.
+ */
+static void *nowait_writer(void *arg)
+{
+	worker_t *worker = arg;
+	char *buffer = malloc(MAX_DATA);
+	int fd;
+
+	if (buffer == NULL)
+		die("malloc");
+
+	memset(buffer, 'w', MAX_DATA);
+	fd = bench_open(worker->vault_id);
+
+	while (nowait_running) {
+		if (pwrite(fd, buffer, MAX_DATA, 0) != MAX_DATA)
+			worker->failed = 1;
+	}
+
+	close(fd);
+	free(buffer);
+
+	return NULL;
+}
+
+/**
+ * @brief Compare blocking and non-blocking reads of a single-threaded event loop.
+ * @details While `NOWAIT_WRITERS` threads write the whole vault, the main thread reads `NOWAIT_READS` records, once with a blocking file and once with a non-blocking one that waits in `poll()` and retries on `EAGAIN`. The longest single call shows how long the loop stalled, as the time in `poll()` could have served other files.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_nowait(unsigned int vault_id)
+{
+	worker_t workers[NOWAIT_WRITERS];
+	char record[NOWAIT_RECORD];
+	uint64_t start, elapsed, call, total, longest;
+	unsigned long reads, again;
+	struct pollfd pfd;
+	unsigned int i;
+	int failed = 0;
+	int nonblock;
+	ssize_t ret;
+
+	bench_create(vault_id, MAX_DATA, 0, 0);
+
+	pfd.fd = bench_open(vault_id);
+	bench_fill(pfd.fd, MAX_DATA);
+
+	nowait_running = 1;
+
+	for (i = 0; i < NOWAIT_WRITERS; i++) {
+		workers[i].vault_id = vault_id;
+		workers[i].slot = i;
+		workers[i].failed = 0;
+
+		if (pthread_create(&workers[i].thread, NULL, nowait_writer, &workers[i]) != 0)
+			die("pthread_create");
+	}
+
+	printf("%10s %14s %14s %14s %10s\n", "mode", "ns/read", "ns/call", "max call ns", "again");
+
+	for (nonblock = 0; nonblock < 2; nonblock++) {
+		if (fcntl(pfd.fd, F_SETFL, nonblock ? O_NONBLOCK : 0) == -1)
+			die("fcntl");
+
+		total = longest = 0;
+		again = 0;
+		start = now_ns();
+
+		for (reads = 0; reads < NOWAIT_READS;) {
+			if (nonblock) {
+				pfd.events = POLLIN;
+				if (poll(&pfd, 1, -1) == -1)
+					die("poll");
+			}
+
+			call = now_ns();
+			ret = pread(pfd.fd, record, sizeof(record), (reads * NOWAIT_RECORD) % MAX_DATA);
+			call = now_ns() - call;
+
+			total += call;
+			if (call > longest)
+				longest = call;
+
+			if (ret == -1 && errno == EAGAIN) {
+				again++;
+				continue;
+			}
+
+			if (ret != sizeof(record))
+				die("read");
+
+			reads++;
+		}
+
+		elapsed = now_ns() - start;
+
+		printf("%10s %14.1f %14.1f %14llu %10lu\n", nonblock ? "nonblock" : "block", (double)elapsed / reads,
+				(double)total / (reads + again), (unsigned long long)longest, again);
+	}
+
+	nowait_running = 0;
+
+	for (i = 0; i < NOWAIT_WRITERS; i++) {
+		pthread_join(workers[i].thread, NULL);
+		failed |= workers[i].failed;
+	}
+
+	close(pfd.fd);
+	bench_delete(vault_id);
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: a writer failed\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Struct of the producer of the queue benchmark.
+ */
+typedef struct {
+	pthread_t thread; ///< The thread.
+	unsigned int vault_id; ///< The id of the vault to write to.
+	size_t size; ///< The size of the messages.
+	int failed; ///< Specifies whether a write failed.
+} producer_t;
+
+/**
+ * @brief Enqueue `QUEUE_OPS` messages.
+ * @details This is the entry point of the producer of the queue benchmark.
+ * @param arg The producer of the thread.
+ * @return `NULL`.
+ */
+static void *queue_producer(void *arg)
+{
+	producer_t *producer = arg;
+	char message[QUEUE_MESSAGE];
+	unsigned long i;
+	int fd;
+
+	fd = bench_open(producer->vault_id);
+
+	for (i = 0; i < QUEUE_OPS; i++) {
+		memset(message, (char)i, producer->size);
+
+		if (write(fd, message, producer->size) != (ssize_t)producer->size)
+			producer->failed = 1;
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+/**
+ * @brief Compare a queue vault with passing messages through a plain vault.
+ * @details For every message size up to `QUEUE_MESSAGE`, a producer thread enqueues `QUEUE_OPS` messages that the main thread dequeues. The baseline passes the same messages through a plain vault as before, with a write, a read and an erase of the vault per message, without a second thread.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_queue(unsigned int vault_id)
+{
+	char message[QUEUE_MESSAGE];
+	uint64_t start, elapsed[2];
+	producer_t producer;
+	struct msg_t msg;
+	unsigned long i;
+	int failed = 0;
+	size_t size;
+	int fd;
+
+	printf("%10s %14s %14s\n", "message", "plain ns/msg", "queue ns/msg");
+
+	for (size = MIN_RECORD; size <= QUEUE_MESSAGE; size *= 4) {
+		bench_create(vault_id, QUEUE_SIZE, 0, 0);
+		fd = bench_open(vault_id);
+
+		memset(&msg, 0, sizeof(msg));
+		msg.device = vault_id;
+
+		start = now_ns();
+
+		for (i = 0; i < QUEUE_OPS; i++) {
+			memset(message, (char)i, size);
+
+			if (pwrite(fd, message, size, 0) != (ssize_t)size || pread(fd, message, size, 0) != (ssize_t)size)
+				die("plain");
+
+			if (ioctl(ctl_fd, 5, &msg) == -1)
+				die("erase");
+
+			failed |= message[size - 1] != (char)i;
+		}
+
+		elapsed[0] = now_ns() - start;
+
+		close(fd);
+		bench_delete(vault_id);
+
+		bench_create(vault_id, QUEUE_SIZE, VAULT_QUEUE, 0);
+		fd = bench_open(vault_id);
+
+		producer.vault_id = vault_id;
+		producer.size = size;
+		producer.failed = 0;
+
+		start = now_ns();
+
+		if (pthread_create(&producer.thread, NULL, queue_producer, &producer) != 0)
+			die("pthread_create");
+
+		for (i = 0; i < QUEUE_OPS; i++) {
+			if (read(fd, message, sizeof(message)) != (ssize_t)size)
+				die("read");
+
+			failed |= message[size - 1] != (char)i;
+		}
+
+		pthread_join(producer.thread, NULL);
+		failed |= producer.failed;
+
+		elapsed[1] = now_ns() - start;
+
+		close(fd);
+		bench_delete(vault_id);
+
+		printf("%10zu %14.1f %14.1f\n", size, (double)elapsed[0] / QUEUE_OPS, (double)elapsed[1] / QUEUE_OPS);
+	}
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: received a message that was not sent\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Write and synchronize records of one slot.
+ * @details This is the entry point of each writer of the persistence benchmark. Every write of `persist_record` bytes is followed by `fsync()`, so the writers wait for durability concurrently.
+ * @param arg The worker of the thread.
+ * @return `NULL`.
+ */
+static void *persist_writer(void *arg)
+{
+	worker_t *worker = arg;
+	unsigned long i, n = PERSIST_BYTES / persist_record / PERSIST_THREADS;
+	char *buffer = malloc(persist_record);
+	off_t offset = (worker->slot * persist_record) % MAX_DATA;
+	int fd;
+
+	if (buffer == NULL)
+		die("malloc");
+
+	memset(buffer, 'p' + worker->slot, persist_record);
+	fd = bench_open(worker->vault_id);
+
+	for (i = 0; i < n && !worker->failed; i++) {
+		if (pwrite(fd, buffer, persist_record, offset) != (ssize_t)persist_record || fsync(fd) != 0)
+			worker->failed = 1;
+	}
+
+	close(fd);
+	free(buffer);
+
+	return NULL;
+}
+
+/**
+ * @brief Compare writes to a vault in memory with writes to a persistent vault.
+ * @details For several record sizes, `PERSIST_BYTES` are written to a plain vault, to a persistent vault whose journal is committed in the background, to a persistent vault with `fsync()` after every write, and by `PERSIST_THREADS` threads doing the same, whose commits are grouped. The persistent vault is then deleted and recovered, and must read back the data written last. The vault needs the directory of the `persist_dir` parameter.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_persist(unsigned int vault_id)
+{
+	static const size_t records[] = { 256, 4096, 65536 };
+	static const char *const modes[] = { "memory", "journal", "fsync", "group" };
+	worker_t workers[PERSIST_THREADS];
+	struct msg_t msg;
+	uint64_t start, elapsed;
+	unsigned long i, n;
+	char *record, *expected, *buffer;
+	unsigned int r, mode, t;
+	int failed = 0;
+	int fd;
+
+	record = malloc(MAX_DATA);
+	expected = malloc(MAX_DATA);
+	buffer = malloc(MAX_DATA);
+	if (record == NULL || expected == NULL || buffer == NULL)
+		die("malloc");
+
+	for (i = 0; i < MAX_DATA; i++)
+		record[i] = rand();
+
+	memset(&msg, 0, sizeof(msg));
+	msg.device = vault_id;
+
+	printf("%10s %10s %12s %12s\n", "record", "mode", "ns/write", "MB/s");
+
+	for (r = 0; r < sizeof(records) / sizeof(records[0]); r++) {
+		persist_record = records[r];
+		n = PERSIST_BYTES / persist_record;
+
+		for (mode = 0; mode < sizeof(modes) / sizeof(modes[0]); mode++) {
+			bench_create(vault_id, MAX_DATA, mode == 0 ? 0 : VAULT_PERSISTENT, 0);
+			fd = bench_open(vault_id);
+
+			start = now_ns();
+
+			if (mode == 3) {
+				for (t = 0; t < PERSIST_THREADS; t++) {
+					workers[t].vault_id = vault_id;
+					workers[t].slot = t;
+					workers[t].failed = 0;
+
+					if (pthread_create(&workers[t].thread, NULL, persist_writer, &workers[t]) != 0)
+						die("pthread_create");
+				}
+
+				for (t = 0; t < PERSIST_THREADS; t++) {
+					pthread_join(workers[t].thread, NULL);
+					failed |= workers[t].failed;
+				}
+			} else {
+				for (i = 0; i < n; i++) {
+					if (pwrite(fd, record + (i * persist_record) % MAX_DATA, persist_record,
+							(i * persist_record) % MAX_DATA) != (ssize_t)persist_record)
+						die("write");
+
+					if (mode == 2 && fsync(fd) != 0)
+						die("fsync");
+				}
+			}
+
+			elapsed = now_ns() - start;
+
+			printf("%10zu %10s %12.1f %12.1f\n", persist_record, modes[mode], (double)elapsed / n,
+					(double)persist_record * n * 1000 / elapsed);
+
+			if (mode == 1) {
+				if (pread(fd, expected, MAX_DATA, 0) != MAX_DATA)
+					die("read");
+
+				close(fd);
+				bench_delete(vault_id);
+
+				// The vault is recovered from its backing file and journal.
+				bench_create(vault_id, MAX_DATA, VAULT_PERSISTENT, 0);
+				fd = bench_open(vault_id);
+
+				if (pread(fd, buffer, MAX_DATA, 0) != MAX_DATA)
+					die("read");
+
+				failed |= memcmp(expected, buffer, MAX_DATA) != 0;
+			}
+
+			// The next persistent vault starts empty.
+			if (mode > 0 && ioctl(ctl_fd, 5, &msg) == -1)
+				die("erase");
+
+			close(fd);
+			bench_delete(vault_id);
+		}
+	}
+
+	free(record);
+	free(expected);
+	free(buffer);
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: a persistent secvault did not hold the data written\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Compare collecting the counters of all vaults from the binary records and from the statistics.
+ * @details Each pass sums the batched requests of all vaults, once by reading `RECORDS_PATH` and once by reading and parsing `STATS_PATH`.
+ * @param vault_id The id of the vault to create, so at least one vault is in use.
+ */
+static void bench_records(unsigned int vault_id)
+{
+	struct vault_record_t records[N_VAULTS];
+	unsigned long requests, batches, sums[2] = { 0, 0 };
+	uint64_t start, elapsed[2];
+	char line[256];
+	unsigned long i;
+	FILE *stats;
+	ssize_t n;
+	int fd, j;
+
+	bench_create(vault_id, 4096, 0, 0);
+
+	fd = open(RECORDS_PATH, O_RDONLY);
+	if (fd < 0)
+		die("open");
+
+	start = now_ns();
+
+	for (i = 0; i < RECORDS_PASSES; i++) {
+		n = pread(fd, records, sizeof(records), 0);
+		if (n < 0)
+			die("read");
+
+		for (j = 0; j < n / (ssize_t)sizeof(records[0]); j++)
+			sums[0] += records[j].combined;
+	}
+
+	elapsed[0] = now_ns() - start;
+	close(fd);
+
+	start = now_ns();
+
+	for (i = 0; i < RECORDS_PASSES; i++) {
+		stats = fopen(STATS_PATH, "r");
+		if (stats == NULL)
+			die("fopen");
+
+		while (fgets(line, sizeof(line), stats) != NULL) {
+			if (sscanf(line, "  combining: requests %lu batches %lu", &requests, &batches) == 2)
+				sums[1] += requests;
+		}
+
+		fclose(stats);
+	}
+
+	elapsed[1] = now_ns() - start;
+
+	bench_delete(vault_id);
+
+	printf("%10s %14s\n", "source", "ns/pass");
+	printf("%10s %14.1f\n", "records", (double)elapsed[0] / RECORDS_PASSES);
+	printf("%10s %14.1f\n", "stats", (double)elapsed[1] / RECORDS_PASSES);
+
+	if (sums[0] != sums[1]) {
+		fprintf(stderr, "[%s] ERROR: the records and the statistics disagree\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Read the combining counters of a vault from the statistics.
+ * @param vault_id The id of the vault.
+ * @param requests The number of requests executed in batches.
+ * @param batches The number of batches.
+ */
+static void combine_counters(unsigned int vault_id, unsigned long *requests, unsigned long *batches)
+{
+	char line[256];
+	int current = -1, id;
+	FILE *f;
+
+	*requests = *batches = 0;
+
+	f = fopen(STATS_PATH, "r");
+	if (f == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "vault %d:", &id) == 1)
+			current = id;
+		else if (current == (int)vault_id)
+			sscanf(line, "  combining: requests %lu batches %lu", requests, batches);
+	}
+
+	fclose(f);
+}
+
+/**
+ * @brief Write and read back the record of a thread repeatedly.
+ * @details This is the entry point of each thread of the combining benchmark. Every thread uses its own file descriptor.
+ * @param arg The worker of the thread.
+ * @return `NULL`.
+ */
+static void *combine_worker(void *arg)
+{
+	worker_t *worker = arg;
+	char record[COMBINE_RECORD], buffer[COMBINE_RECORD];
+	off_t offset = (off_t)worker->slot * COMBINE_RECORD;
+	unsigned long i;
+	int fd;
+
+	fd = bench_open(worker->vault_id);
+
+	for (i = 0; i < COMBINE_OPS; i++) {
+		memset(record, (int)(worker->slot + i), sizeof(record));
+
+		if (pwrite(fd, record, sizeof(record), offset) != sizeof(record))
+			die("write");
+
+		if (pread(fd, buffer, sizeof(buffer), offset) != sizeof(buffer))
+			die("read");
+
+		if (memcmp(record, buffer, sizeof(record)) != 0)
+			worker->failed = 1;
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+/**
+ * @brief Measure small reads and writes of concurrent threads on one vault.
+ * @details For every thread count up to `COMBINE_THREADS`, each thread writes and reads back its own record. The number of requests per batch is taken from the statistics, if available.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_combine(unsigned int vault_id)
+{
+	worker_t workers[COMBINE_THREADS];
+	unsigned long requests, batches, prev_requests, prev_batches;
+	unsigned int threads, i;
+	uint64_t start, elapsed;
+	int failed = 0;
+
+	bench_create(vault_id, COMBINE_THREADS * COMBINE_RECORD, 0, 0);
+
+	printf("%8s %14s %12s %16s\n", "threads", "ns/op", "Mops/s", "requests/batch");
+
+	for (threads = 1; threads <= COMBINE_THREADS; threads *= 2) {
+		combine_counters(vault_id, &prev_requests, &prev_batches);
+
+		start = now_ns();
+
+		for (i = 0; i < threads; i++) {
+			workers[i].vault_id = vault_id;
+			workers[i].slot = i;
+			workers[i].failed = 0;
+
+			if (pthread_create(&workers[i].thread, NULL, combine_worker, &workers[i]) != 0)
+				die("pthread_create");
+		}
+
+		for (i = 0; i < threads; i++) {
+			pthread_join(workers[i].thread, NULL);
+			failed |= workers[i].failed;
+		}
+
+		elapsed = now_ns() - start;
+
+		combine_counters(vault_id, &requests, &batches);
+
+		printf("%8u %14.1f %12.3f %16.2f\n", threads,
+				(double)elapsed / (2.0 * COMBINE_OPS * threads),
+				2.0 * COMBINE_OPS * threads * 1000 / elapsed,
+				batches > prev_batches ? (double)(requests - prev_requests) / (batches - prev_batches) : 0);
+	}
+
+	bench_delete(vault_id);
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: a thread read back data it did not write\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Read the hot record repeatedly.
+ * @details This is the entry point of each thread of the hot read benchmark.
+ * @param arg The worker of the thread.
+ * @return `NULL`.
+ */
+static void *hotread_worker(void *arg)
+{
+	worker_t *worker = arg;
+	char expected[HOT_RECORD], buffer[HOT_RECORD];
+	unsigned long i;
+	int fd;
+
+	memset(expected, 'h', sizeof(expected));
+	fd = bench_open(worker->vault_id);
+
+	for (i = 0; i < COMBINE_OPS; i++) {
+		if (pread(fd, buffer, sizeof(buffer), 0) != sizeof(buffer))
+			die("read");
+
+		if (memcmp(expected, buffer, sizeof(buffer)) != 0)
+			worker->failed = 1;
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+/**
+ * @brief Measure concurrent reads of the same small record.
+ * @details For every thread count up to `COMBINE_THREADS`, all threads read the same record. Ideally, the throughput scales with the number of threads.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_hotread(unsigned int vault_id)
+{
+	worker_t workers[COMBINE_THREADS];
+	char record[HOT_RECORD];
+	unsigned int threads, i;
+	uint64_t start, elapsed;
+	int failed = 0;
+	int fd;
+
+	bench_create(vault_id, HOT_RECORD, 0, 0);
+
+	fd = bench_open(vault_id);
+	memset(record, 'h', sizeof(record));
+	if (pwrite(fd, record, sizeof(record), 0) != sizeof(record))
+		die("write");
+	close(fd);
+
+	printf("%8s %14s %12s\n", "threads", "ns/op", "Mops/s");
+
+	for (threads = 1; threads <= COMBINE_THREADS; threads *= 2) {
+		start = now_ns();
+
+		for (i = 0; i < threads; i++) {
+			workers[i].vault_id = vault_id;
+			workers[i].slot = 0;
+			workers[i].failed = 0;
+
+			if (pthread_create(&workers[i].thread, NULL, hotread_worker, &workers[i]) != 0)
+				die("pthread_create");
+		}
+
+		for (i = 0; i < threads; i++) {
+			pthread_join(workers[i].thread, NULL);
+			failed |= workers[i].failed;
+		}
+
+		elapsed = now_ns() - start;
+
+		printf("%8u %14.1f %12.3f\n", threads, (double)elapsed / ((double)COMBINE_OPS * threads),
+				(double)COMBINE_OPS * threads * 1000 / elapsed);
+	}
+
+	bench_delete(vault_id);
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: a thread read back wrong data\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Write and read back the record of a thread repeatedly.
+ * @details This is the entry point of each thread of the striping benchmark. Every record lies in its own stripe.
+ * @param arg The worker of the thread.
+ * @return `NULL`.
+ */
+static void *stripe_worker(void *arg)
+{
+	worker_t *worker = arg;
+	char record[STRIPE_RECORD], buffer[STRIPE_RECORD];
+	off_t offset = (off_t)worker->slot * STRIPE_RECORD;
+	unsigned long i;
+	int fd;
+
+	fd = bench_open(worker->vault_id);
+
+	for (i = 0; i < STRIPE_OPS; i++) {
+		memset(record, (int)(worker->slot + i), sizeof(record));
+
+		if (pwrite(fd, record, sizeof(record), offset) != sizeof(record))
+			die("write");
+
+		if (pread(fd, buffer, sizeof(buffer), offset) != sizeof(buffer))
+			die("read");
+
+		if (memcmp(record, buffer, sizeof(record)) != 0)
+			worker->failed = 1;
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+/**
+ * @brief Compare concurrent requests on a plain and a striped vault.
+ * @details For every thread count up to `COMBINE_THREADS`, each thread writes and reads back its own record, once on a plain vault and once on a vault with one stripe per record.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_striped(unsigned int vault_id)
+{
+	worker_t workers[COMBINE_THREADS];
+	unsigned int threads, i, flags;
+	uint64_t start, elapsed[2];
+	int failed = 0;
+
+	printf("%8s %14s %14s\n", "threads", "plain MB/s", "striped MB/s");
+
+	for (threads = 1; threads <= COMBINE_THREADS; threads *= 2) {
+		for (flags = 0; flags < 2; flags++) {
+			bench_create(vault_id, COMBINE_THREADS * STRIPE_RECORD, flags ? VAULT_STRIPED : 0, flags ? STRIPE_RECORD : 0);
+
+			start = now_ns();
+
+			for (i = 0; i < threads; i++) {
+				workers[i].vault_id = vault_id;
+				workers[i].slot = i;
+				workers[i].failed = 0;
+
+				if (pthread_create(&workers[i].thread, NULL, stripe_worker, &workers[i]) != 0)
+					die("pthread_create");
+			}
+
+			for (i = 0; i < threads; i++) {
+				pthread_join(workers[i].thread, NULL);
+				failed |= workers[i].failed;
+			}
+
+			elapsed[flags] = now_ns() - start;
+
+			bench_delete(vault_id);
+		}
+
+		printf("%8u %14.1f %14.1f\n", threads,
+				2.0 * STRIPE_RECORD * STRIPE_OPS * threads * 1000 / elapsed[0],
+				2.0 * STRIPE_RECORD * STRIPE_OPS * threads * 1000 / elapsed[1]);
+	}
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: a thread read back data it did not write\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Read the deduplication counters of a vault from the statistics.
+ * @param vault_id The id of the vault.
+ * @param blocks The number of blocks of the vault holding data.
+ * @param stored The number of distinct blocks stored.
+ */
+static void dedup_counters(unsigned int vault_id, unsigned long *blocks, unsigned long *stored)
+{
+	char line[256];
+	int current = -1, id;
+	FILE *f;
+
+	*blocks = *stored = 0;
+
+	f = fopen(STATS_PATH, "r");
+	if (f == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "vault %d:", &id) == 1)
+			current = id;
+		else if (current == (int)vault_id)
+			sscanf(line, "  dedup: blocks %lu stored %lu", blocks, stored);
+	}
+
+	fclose(f);
+}
+
+/**
+ * @brief Measure a deduplicated vault for different numbers of distinct blocks.
+ * @details For every power of two up to `DEDUP_DISTINCT`, the whole vault is filled with that many distinct blocks in turn, read back and checked. Then one byte of the first block is changed, which must not affect the blocks sharing its storage.
+ * @param vault_id The id of the vault to use.
+ */
+static void bench_dedup(unsigned int vault_id)
+{
+	char *expected = malloc(MAX_DATA);
+	char *buffer = malloc(MAX_DATA);
+	unsigned long distinct, blocks, stored, i;
+	uint64_t start, written, read;
+	int failed = 0;
+	int fd;
+
+	if (expected == NULL || buffer == NULL)
+		die("malloc");
+
+	printf("%8s %8s %8s %8s %12s %12s\n", "distinct", "blocks", "stored", "ratio", "write MB/s", "read MB/s");
+
+	for (distinct = 1; distinct <= DEDUP_DISTINCT; distinct *= 2) {
+		for (i = 0; i < MAX_DATA; i++)
+			expected[i] = (i % DEDUP_BLOCK) * 31 + (i / DEDUP_BLOCK % distinct) * 7;
+
+		bench_create(vault_id, MAX_DATA, VAULT_DEDUP, 0);
+		fd = bench_open(vault_id);
+
+		start = now_ns();
+		if (pwrite(fd, expected, MAX_DATA, 0) != MAX_DATA)
+			die("write");
+		written = now_ns() - start;
+
+		start = now_ns();
+		if (pread(fd, buffer, MAX_DATA, 0) != MAX_DATA)
+			die("read");
+		read = now_ns() - start;
+
+		failed |= memcmp(expected, buffer, MAX_DATA) != 0;
+
+		dedup_counters(vault_id, &blocks, &stored);
+
+		// The first block is copied before it is changed.
+		expected[0] ^= 1;
+		if (pwrite(fd, expected, 1, 0) != 1 || pread(fd, buffer, MAX_DATA, 0) != MAX_DATA)
+			die("write");
+
+		failed |= memcmp(expected, buffer, MAX_DATA) != 0;
+
+		close(fd);
+		bench_delete(vault_id);
+
+		printf("%8lu %8lu %8lu %8.2f %12.1f %12.1f\n", distinct, blocks, stored,
+				stored ? (double)blocks / stored : 0.0,
+				(double)MAX_DATA * 1000 / written, (double)MAX_DATA * 1000 / read);
+	}
+
+	free(expected);
+	free(buffer);
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: read back data that was not written\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Measure the multi-buffer transform for all lane counts and small record sizes.
+ * @details The records are transformed by batches of up to `TRANSFORM_LANES` lanes, each with its own key and offset, as the combiner does. Every batch is checked against a byte-wise transform once.
+ */
+static void bench_lanes(void)
+{
+	static char records[TRANSFORM_LANES][LANES_RECORD], expected[TRANSFORM_LANES][LANES_RECORD];
+	static char keys[TRANSFORM_LANES][KEYSIZE];
+	struct transform_lane lanes[TRANSFORM_LANES];
+	unsigned long ops, offset;
+	unsigned int n, j, failed = 0;
+	size_t record, i;
+	uint64_t start;
+
+	for (j = 0; j < TRANSFORM_LANES; j++) {
+		for (i = 0; i < KEYSIZE; i++)
+			keys[j][i] = rand();
+	}
+
+	printf("%8s", "record");
+	for (n = 1; n <= TRANSFORM_LANES; n *= 2)
+		printf(" %6u lanes", n);
+	printf("  (ns/record)\n");
+
+	for (record = MIN_RECORD; record <= LANES_RECORD; record *= 2) {
+		printf("%8zu", record);
+
+		for (n = 1; n <= TRANSFORM_LANES; n *= 2) {
+			for (j = 0; j < n; j++) {
+				offset = rand() % MAX_DATA;
+
+				for (i = 0; i < record; i++) {
+					records[j][i] = rand();
+					expected[j][i] = records[j][i] ^ keys[j][(offset + i) % KEYSIZE];
+				}
+
+				lanes[j].buffer = records[j];
+				lanes[j].len = record - j % 3;
+				lanes[j].offset = offset;
+				lanes[j].key = keys[j];
+			}
+
+			transform_lanes(lanes, n);
+
+			for (j = 0; j < n; j++)
+				failed |= memcmp(records[j], expected[j], lanes[j].len) != 0;
+
+			start = now_ns();
+
+			for (ops = 0; ops < LANES_OPS; ops += n)
+				transform_lanes(lanes, n);
+
+			printf(" %12.2f", (double)(now_ns() - start) / LANES_OPS);
+		}
+
+		printf("\n");
+	}
+
+	if (failed) {
+		fprintf(stderr, "[%s] ERROR: the multi-buffer transform differs from the byte-wise one\n", progname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Get the number of bytes in active slab objects.
+ * @return The number of bytes, negative value if `/proc/slabinfo` cannot be read.
+ */
+static double soak_slab(void)
+{
+	char line[512], name[64];
+	unsigned long active, total, objsize;
+	double bytes = 0;
+	FILE *f;
+
+	f = fopen("/proc/slabinfo", "r");
+	if (f == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%63s %lu %lu %lu", name, &active, &total, &objsize) == 4)
+			bytes += (double)active * objsize;
+	}
+
+	fclose(f);
+
+	return bytes;
+}
+
+/**
+ * @brief Get the unusable free space index of the buddy allocator.
+ * @details This is the share of free memory in blocks smaller than `SOAK_FRAG_ORDER`, summed over all zones.
+ * @return The index between `0` and `1`, negative value if `/proc/buddyinfo` cannot be read.
+ */
+static double soak_frag(void)
+{
+	char line[512];
+	double free_pages = 0, usable_pages = 0;
+	unsigned long count;
+	int order, consumed;
+	char *cursor;
+	FILE *f;
+
+	f = fopen("/proc/buddyinfo", "r");
+	if (f == NULL)
+		return -1;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		// Skip "Node <n>, zone <name>".
+		cursor = strstr(line, "zone");
+		if (cursor == NULL || sscanf(cursor, "zone %*s%n", &consumed) < 0)
+			continue;
+
+		cursor += consumed;
+
+		for (order = 0; sscanf(cursor, "%lu%n", &count, &consumed) == 1; order++) {
+			free_pages += (double)count * (1UL << order);
+
+			if (order >= SOAK_FRAG_ORDER)
+				usable_pages += (double)count * (1UL << order);
+
+			cursor += consumed;
+		}
+	}
+
+	fclose(f);
+
+	if (free_pages == 0)
+		return -1;
+
+	return 1 - usable_pages / free_pages;
+}
+
+/**
+ * @brief Take a sample of the memory counters.
+ * @param sample The sample to fill in.
+ * @param start The start time of the benchmark.
+ */
+static void soak_sample(sample_t *sample, uint64_t start)
+{
+	FILE *f;
+
+	sample->hours = (double)(now_ns() - start) / 3600e9;
+	sample->slab = soak_slab();
+	sample->frag = soak_frag();
+	sample->storage = -1;
+	sample->allocs = -1;
+
+	f = fopen(STATS_PATH, "r");
+	if (f != NULL) {
+		if (fscanf(f, "memory: storage %ld allocations %ld", &sample->storage, &sample->allocs) != 2)
+			sample->storage = sample->allocs = -1;
+
+		fclose(f);
+	}
+}
+
+/**
+ * @brief Get the trend of a value over the samples.
+ * @details The trend is the slope of the least squares line through the samples after warm-up.
+ * @param samples The samples.
+ * @param n The number of samples.
+ * @param offset The offset of the value in a sample.
+ * @return The change of the value per hour.
+ */
+static double soak_trend(const sample_t *samples, size_t n, size_t offset)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, x, y, m;
+	size_t i;
+
+	if (n <= SOAK_WARMUP + 1)
+		return 0;
+
+	for (i = SOAK_WARMUP; i < n; i++) {
+		x = samples[i].hours;
+		y = *(const double *)((const char *)&samples[i] + offset);
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+
+	m = n - SOAK_WARMUP;
+
+	if (m * sxx - sx * sx == 0)
+		return 0;
+
+	return (m * sxy - sx * sy) / (m * sxx - sx * sx);
+}
+
+/**
+ * @brief Run one random step of a vault lifecycle.
+ * @details The vault is created with random size and flags, then written, read, erased, partitioned and fanned out to, until it is deleted again.
+ * @param vault_id The id of the vault to use.
+ * @param fd The file descriptor of the vault, negative value if it does not exist.
+ * @param size The size of the vault.
+ * @param buffer A buffer of `MAX_DATA` bytes.
+ * @return The file descriptor of the vault after the step.
+ */
+static int soak_step(unsigned int vault_id, int fd, unsigned long *size, char *buffer)
+{
+	static const unsigned int flags[] = { 0, VAULT_REPLICATED, VAULT_MAPPABLE };
+	static unsigned int n_parts;
+	struct fanout_target_t target;
+	struct fanout_msg_t fanout;
+	struct part_msg_t part;
+	unsigned long offset, len;
+	int action = rand() % 100;
+
+	if (fd < 0) {
+		*size = 1 + rand() % MAX_DATA;
+		bench_create(vault_id, *size, flags[rand() % 3], 0);
+		n_parts = 0;
+		return bench_open(vault_id);
+	}
+
+	offset = rand() % *size;
+	len = 1 + rand() % (*size - offset);
+
+	if (action < 55) {
+		if (pwrite(fd, buffer, len, offset) < 0)
+			die("write");
+	} else if (action < 75) {
+		if (pread(fd, buffer, len, offset) < 0)
+			die("read");
+	} else if (action < 80) {
+		memset(&fanout, 0, sizeof(fanout));
+		memset(&target, 0, sizeof(target));
+		target.device = vault_id;
+		target.offset = offset;
+		fanout.payload = (uintptr_t)buffer;
+		fanout.len = len;
+		fanout.targets = (uintptr_t)&target;
+		fanout.n_targets = 1;
+
+		if (ioctl(ctl_fd, SV_CTL_FANOUT, &fanout) == -1 || target.status < 0)
+			die("fan-out write");
+	} else if (action < 90) {
+		memset(&part, 0, sizeof(part));
+		part.device = vault_id;
+		part.owner = getuid();
+
+		if (n_parts > 0 && rand() % 2 == 0) {
+			snprintf(part.name, sizeof(part.name), "soak%u", --n_parts);
+
+			if (ioctl(ctl_fd, SV_CTL_DEL_PARTITION, &part) == -1)
+				die("remove partition");
+		} else if (n_parts < MAX_PARTITIONS) {
+			snprintf(part.name, sizeof(part.name), "soak%u", n_parts);
+			part.size = 1 + rand() % (*size / MAX_PARTITIONS + 1);
+
+			// A fragmented vault might have no room left, which is fine.
+			if (ioctl(ctl_fd, SV_CTL_ADD_PARTITION, &part) == 0)
+				n_parts++;
+			else if (errno != ENOSPC)
+				die("add partition");
+		}
+	} else if (action < 97) {
+		struct msg_t msg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.device = vault_id;
+
+		if (ioctl(ctl_fd, 5, &msg) == -1)
+			die("erase");
+	} else {
+		close(fd);
+		bench_delete(vault_id);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * @brief Run random vault lifecycles for a long time and track memory usage.
+ * @details Samples of slab usage, buddy allocator fragmentation and the memory counters of the module are printed as CSV. In the end, trends are reported that hint at leaks or fragmentation.
+ * @param vault_id The id of the vault to use.
+ * @param seconds The duration of the benchmark.
+ */
+static void bench_soak(unsigned int vault_id, unsigned long seconds)
+{
+	sample_t *samples = NULL;
+	size_t n = 0;
+	uint64_t start, next;
+	unsigned long size = 0, ops = 0;
+	double slab_trend, frag_trend;
+	char *buffer;
+	int fd = -1;
+	bool failed = false;
+	size_t i;
+
+	buffer = malloc(MAX_DATA);
+	if (buffer == NULL)
+		die("malloc");
+
+	for (i = 0; i < MAX_DATA; i++)
+		buffer[i] = rand();
+
+	printf("hours,slab_bytes,unusable_index,storage_bytes,storage_allocs,ops\n");
+
+	start = now_ns();
+	next = start;
+
+	for (;;) {
+		if (now_ns() >= next) {
+			samples = realloc(samples, (n + 1) * sizeof(*samples));
+			if (samples == NULL)
+				die("realloc");
+
+			soak_sample(&samples[n], start);
+			printf("%.4f,%.0f,%.4f,%ld,%ld,%lu\n", samples[n].hours, samples[n].slab,
+					samples[n].frag, samples[n].storage, samples[n].allocs, ops);
+			fflush(stdout);
+
+			n++;
+			next += (uint64_t)SOAK_INTERVAL * 1000000000;
+
+			if (now_ns() - start >= (uint64_t)seconds * 1000000000)
+				break;
+		}
+
+		fd = soak_step(vault_id, fd, &size, buffer);
+		ops++;
+	}
+
+	if (fd >= 0) {
+		close(fd);
+		bench_delete(vault_id);
+	}
+
+	// With all vaults gone, the module must not hold any storage.
+	soak_sample(&samples[n - 1], start);
+
+	if (samples[n - 1].storage != 0 || samples[n - 1].allocs != 0) {
+		fprintf(stderr, "LEAK: module still holds %ld bytes in %ld allocations\n",
+				samples[n - 1].storage, samples[n - 1].allocs);
+		failed = true;
+	}
+
+	slab_trend = soak_trend(samples, n, offsetof(sample_t, slab));
+	frag_trend = soak_trend(samples, n, offsetof(sample_t, frag));
+
+	fprintf(stderr, "slab trend: %.0f bytes/hour\n", slab_trend);
+	fprintf(stderr, "fragmentation trend: %.4f/hour\n", frag_trend);
+
+	if (samples[0].slab >= 0 && slab_trend > SOAK_SLAB_GROWTH) {
+		fprintf(stderr, "LEAK: slab usage keeps growing\n");
+		failed = true;
+	}
+
+	if (samples[0].frag >= 0 && frag_trend > SOAK_FRAG_GROWTH) {
+		fprintf(stderr, "FRAGMENTATION: share of unusable free memory keeps growing\n");
+		failed = true;
+	}
+
+	free(samples);
+	free(buffer);
+
+	if (failed)
+		exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief The entry point of the program.
+ * @param argc The program argument vector length.
+ * @param argv The program argument vector.
+ */
+int main(int argc, char *argv[])
+{
+	char *endptr;
+	long int vault_id;
+	long int seconds = SOAK_DURATION;
+
+	progname = argv[0];
+
+	if (argc == 2 && strcmp(argv[1], "lanes") == 0) {
+		bench_lanes();
+		return EXIT_SUCCESS;
+	}
+
+	if (argc != 3 && argc != 4)
+		usage();
+
+	vault_id = strtol(argv[2], &endptr, 10);
+	if (*endptr != '\0' || vault_id < 0 || vault_id >= N_VAULTS)
+		usage();
+
+	if (argc == 4) {
+		seconds = strtol(argv[3], &endptr, 10);
+		if (*endptr != '\0' || seconds < 1)
+			usage();
+	}
+
+	ctl_fd = open(SV_CTL, O_RDWR);
+	if (ctl_fd < 0)
+		die("open");
+
+	if (strcmp(argv[1], "mapped") == 0 && argc == 3)
+		bench_mapped(vault_id);
+	else if (strcmp(argv[1], "soak") == 0)
+		bench_soak(vault_id, seconds);
+	else if (strcmp(argv[1], "combine") == 0 && argc == 3)
+		bench_combine(vault_id);
+	else if (strcmp(argv[1], "hotread") == 0 && argc == 3)
+		bench_hotread(vault_id);
+	else if (strcmp(argv[1], "striped") == 0 && argc == 3)
+		bench_striped(vault_id);
+	else if (strcmp(argv[1], "dedup") == 0 && argc == 3)
+		bench_dedup(vault_id);
+	else if (strcmp(argv[1], "zerocopy") == 0 && argc == 3)
+		bench_zerocopy(vault_id);
+	else if (strcmp(argv[1], "ioctl") == 0 && argc == 3)
+		bench_ioctl(vault_id);
+	else if (strcmp(argv[1], "nowait") == 0 && argc == 3)
+		bench_nowait(vault_id);
+	else if (strcmp(argv[1], "queue") == 0 && argc == 3)
+		bench_queue(vault_id);
+	else if (strcmp(argv[1], "records") == 0 && argc == 3)
+		bench_records(vault_id);
+	else if (strcmp(argv[1], "latency") == 0 && argc == 3)
+		bench_latency(vault_id);
+	else if (strcmp(argv[1], "persist") == 0 && argc == 3)
+		bench_persist(vault_id);
+	else
+		usage();
+
+	return EXIT_SUCCESS;
+}
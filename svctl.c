@@ -3,9 +3,12 @@
  * @author eikendev
  * @date 2018-01-16
  * @brief This module contains the control program for the kernel module.
- * @details The control program is used to set up, delete and erase vaults.
+ * @details The control program is used to set up, delete and erase vaults, and to move files into and out of vaults.
  */
 
+// copy_file_range() is a GNU extension.
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -17,8 +20,11 @@
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 
 #include "common.h"
 
@@ -27,6 +33,26 @@
  */
 #define SV_CTL "/dev/sv_ctl"
 
+/**
+ * @brief The size of the buffer of each transfer thread.
+ */
+#define TRANSFER_BUFFER 262144
+
+/**
+ * @brief The alignment of the transfer buffers and ranges.
+ */
+#define TRANSFER_ALIGN 4096
+
+/**
+ * @brief The maximum number of transfer threads.
+ */
+#define MAX_THREADS 64
+
+/**
+ * @brief The interval between two progress reports in milliseconds.
+ */
+#define PROGRESS_INTERVAL 200
+
 /**
  * @brief The name of the program.
  */
@@ -43,21 +69,158 @@ static int ctl_fd = -1;
 typedef struct {
 	enum vault_cmd cmd; ///< The command that was selected.
 	unsigned long size; ///< The size of the vault to be created.
+	unsigned int flags; ///< The flags of the vault to be created.
+	unsigned long stripe_size; ///< The size of the stripes of the vault to be created.
+	char partition[PARTNAME + 1]; ///< The name of the specified partition.
+	unsigned int part_owner; ///< The owner of the partition to be added.
 	unsigned int vault_id; ///< The id of the specified vault.
+	unsigned int other_id; ///< The id of the vault to compare with.
+	char *path; ///< The file to transfer from or to.
+	unsigned int threads; ///< The number of threads to transfer with.
 } options_t;
 
+/**
+ * @brief Struct of a transfer between a file and a vault.
+ */
+typedef struct {
+	int src_fd; ///< The file descriptor to read from.
+	int dst_fd; ///< The file descriptor to write to.
+	unsigned long len; ///< The number of bytes to transfer.
+	unsigned long done; ///< The number of bytes transferred so far, updated atomically.
+	int error; ///< The first error that occurred, `0` if none.
+} transfer_t;
+
+/**
+ * @brief Struct of the range a transfer thread copies.
+ */
+typedef struct {
+	transfer_t *transfer; ///< The transfer the range belongs to.
+	pthread_t thread; ///< The thread copying the range.
+	unsigned long start; ///< The start of the range.
+	unsigned long end; ///< The end of the range.
+} range_t;
+
 /**
  * @brief Print a usage message.
  * @details The function terminates the program with the value `EXIT_FAILURE`. The global variable `progname` has to be defined in order for this function to work.
  */
 static void usage(void)
 {
-	fprintf(stderr, "Usage: %s [-c <size>|-k|-e|-d] <secvault id>\n", progname);
+	fprintf(stderr, "Usage: %s [-c <size> [-R|-M|-S <stripe size>|-D|-Q|-P]|-k|-e|-d|-i|-a <name>:<size>[:<uid>]|-r <name>] <secvault id>\n", progname);
+	fprintf(stderr, "       %s put [-j <threads>] <file> <secvault id>\n", progname);
+	fprintf(stderr, "       %s get [-j <threads>] <secvault id> <file>\n", progname);
+	fprintf(stderr, "       %s diff <secvault id> <secvault id>\n", progname);
+	fprintf(stderr, "       %s list\n", progname);
 	fprintf(stderr, "  <size> must be a positive number.\n");
+	fprintf(stderr, "  <name> must be at most %d characters long.\n", PARTNAME);
+	fprintf(stderr, "  -R keeps a replica of the secvault on every NUMA node.\n");
+	fprintf(stderr, "  -M allows the owner to map the secvault and decrypt it in userspace.\n");
+	fprintf(stderr, "  -D stores identical blocks of %d bytes of the secvault only once.\n", DEDUP_BLOCK);
+	fprintf(stderr, "  -Q uses the secvault as a queue, where every read consumes the oldest message written.\n");
+	fprintf(stderr, "  -P persists the secvault in a backing file with a journal, and recovers it if it exists.\n");
+	fprintf(stderr, "  diff prints the ranges in which two secvaults differ, and fails if there are any.\n");
+	fprintf(stderr, "  list prints the metadata and counters of all secvaults, and needs access to debugfs.\n");
 	fprintf(stderr, "  <secvault id> must specify a valid secvault.\n");
 	exit(EXIT_FAILURE);
 }
 
+/**
+ * @brief Parse the specification of a partition to add.
+ * @details The specification has the form `<name>:<size>[:<uid>]`. The owner defaults to the calling user.
+ * @param spec The specification to parse.
+ * @param options The struct in which to store the configuration in.
+ */
+static void parse_partition(char *spec, options_t *options)
+{
+	char *name = strtok(spec, ":");
+	char *size_str = strtok(NULL, ":");
+	char *owner_str = strtok(NULL, ":");
+	char *endptr;
+	long int size, owner;
+
+	if (name == NULL || size_str == NULL || strtok(NULL, ":") != NULL)
+		usage();
+
+	if (strlen(name) > PARTNAME)
+		usage();
+
+	size = strtol(size_str, &endptr, 10);
+	if (*endptr != '\0' || size < 1 || size > MAX_DATA)
+		usage();
+
+	owner = getuid();
+	if (owner_str != NULL) {
+		owner = strtol(owner_str, &endptr, 10);
+		if (*endptr != '\0' || owner < 0 || owner > UINT_MAX)
+			usage();
+	}
+
+	strcpy(options->partition, name);
+	options->size = size;
+	options->part_owner = owner;
+}
+
+/**
+ * @brief Parse the id of a vault.
+ * @details Terminates the program if the id is invalid.
+ * @param arg The argument to parse.
+ * @return The id of the vault.
+ */
+static unsigned int parse_vault_id(const char *arg)
+{
+	char *endptr;
+	long int vault_id = strtol(arg, &endptr, 10);
+
+	if (*endptr != '\0')
+		usage();
+
+	if (vault_id < 0 || vault_id > UINT_MAX || vault_id >= N_VAULTS)
+		usage();
+
+	return vault_id;
+}
+
+/**
+ * @brief Parse the arguments of the put and get subcommands.
+ * @param argc The program argument vector length.
+ * @param argv The program argument vector.
+ * @param options The struct in which to store the configuration in.
+ */
+static void parse_transfer(int argc, char *argv[], options_t *options)
+{
+	char *endptr;
+	long int threads;
+	int c;
+
+	options->cmd = strcmp(argv[1], "put") == 0 ? PUT : GET;
+	options->threads = 1;
+
+	// skip the subcommand
+	optind = 2;
+
+	while ((c = getopt(argc, argv, "j:")) != -1) {
+		if (c != 'j')
+			usage();
+
+		threads = strtol(optarg, &endptr, 10);
+		if (*endptr != '\0' || threads < 1 || threads > MAX_THREADS)
+			usage();
+
+		options->threads = threads;
+	}
+
+	if (argc - optind != 2)
+		usage();
+
+	if (options->cmd == PUT) {
+		options->path = argv[optind];
+		options->vault_id = parse_vault_id(argv[optind + 1]);
+	} else {
+		options->vault_id = parse_vault_id(argv[optind]);
+		options->path = argv[optind + 1];
+	}
+}
+
 /**
  * @brief Parse the arguments passed as program arguments.
  * @details Program parsing conforms to POSIX standard.
@@ -69,10 +232,70 @@ static void parse_arguments(int argc, char *argv[], options_t *options)
 {
 	opterr = 0;
 
+	if (argc > 1 && (strcmp(argv[1], "put") == 0 || strcmp(argv[1], "get") == 0)) {
+		parse_transfer(argc, argv, options);
+		return;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "list") == 0) {
+		if (argc != 2)
+			usage();
+
+		options->cmd = LIST;
+		return;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "diff") == 0) {
+		if (argc != 4)
+			usage();
+
+		options->cmd = DIFF;
+		options->vault_id = parse_vault_id(argv[2]);
+		options->other_id = parse_vault_id(argv[3]);
+		return;
+	}
+
 	bool parsed_cmd = false;
 
 	int c;
-	while ((c = getopt(argc, argv, "c:ked")) != -1) {
+	while ((c = getopt(argc, argv, "c:kedRMS:DQPia:r:")) != -1) {
+		if (c == 'R') {
+			options->flags |= VAULT_REPLICATED;
+			continue;
+		}
+
+		if (c == 'S') {
+			char *endptr;
+			long int stripe_size = strtol(optarg, &endptr, 10);
+
+			if (*endptr != '\0' || stripe_size < 1 || stripe_size > MAX_DATA)
+				usage();
+
+			options->flags |= VAULT_STRIPED;
+			options->stripe_size = stripe_size;
+			continue;
+		}
+
+		if (c == 'M') {
+			options->flags |= VAULT_MAPPABLE;
+			continue;
+		}
+
+		if (c == 'D') {
+			options->flags |= VAULT_DEDUP;
+			continue;
+		}
+
+		if (c == 'Q') {
+			options->flags |= VAULT_QUEUE;
+			continue;
+		}
+
+		if (c == 'P') {
+			options->flags |= VAULT_PERSISTENT;
+			continue;
+		}
+
 		if (parsed_cmd)
 			usage();
 
@@ -101,6 +324,21 @@ static void parse_arguments(int argc, char *argv[], options_t *options)
 		case 'd':
 			options->cmd = DELETE;
 			break;
+		case 'i':
+			options->cmd = INFO;
+			break;
+		case 'a':
+			options->cmd = ADD_PARTITION;
+			parse_partition(optarg, options);
+			break;
+		case 'r':
+			options->cmd = DEL_PARTITION;
+
+			if (strlen(optarg) < 1 || strlen(optarg) > PARTNAME)
+				usage();
+
+			strcpy(options->partition, optarg);
+			break;
 		default:
 			usage();
 		}
@@ -110,20 +348,15 @@ static void parse_arguments(int argc, char *argv[], options_t *options)
 	if (!parsed_cmd)
 		usage();
 
-	// we need the secvault id
-	if (argc - optind != 1)
+	// flags only apply to creation
+	if (options->flags != 0 && options->cmd != CREATE)
 		usage();
 
-	char *endptr;
-	long int vault_id = strtol(argv[optind], &endptr, 10);
-
-	if (*endptr != '\0')
-		usage();
-
-	if (vault_id < 0 || vault_id > UINT_MAX || vault_id >= N_VAULTS)
+	// we need the secvault id
+	if (argc - optind != 1)
 		usage();
 
-	options->vault_id = vault_id;
+	options->vault_id = parse_vault_id(argv[optind]);
 }
 
 /**
@@ -159,19 +392,46 @@ static void read_user_key(char *buffer) {
 		free(line);
 }
 
+/**
+ * @brief Open the device of a vault.
+ * @param vault_id The id of the vault to open.
+ * @param flags The flags to open the device with.
+ * @return The file descriptor of the vault.
+ */
+static int open_vault(uint8_t vault_id, int flags)
+{
+	char path[32];
+	int fd;
+
+	snprintf(path, sizeof(path), "/dev/sv_data%u", vault_id);
+
+	fd = open(path, flags);
+	if (fd < 0) {
+		fprintf(stderr, "[%s] ERROR: open failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	return fd;
+}
+
 /**
  * @brief Create a new vault.
  * @details Requests a new vault from the ioctl device.
  * @param vault_id The id of the vault to create.
  * @param size The maximum size of the vault.
+ * @param flags The flags to create the vault with.
+ * @param stripe_size The size of the stripes of a striped vault.
  */
-static void sv_create(uint8_t vault_id, uint16_t size)
+static void sv_create(uint8_t vault_id, unsigned long size, unsigned int flags, unsigned long stripe_size)
 {
 	int errind;
 
 	struct msg_t msg;
+	memset(&msg, 0, sizeof(msg));
 	msg.device = vault_id;
 	msg.size = size;
+	msg.flags = flags;
+	msg.stripe_size = stripe_size;
 
 	printf("Encryption key: ");
 	fflush(stdout);
@@ -194,6 +454,7 @@ static void sv_change_key(uint8_t vault_id)
 	int errind;
 
 	struct msg_t msg;
+	memset(&msg, 0, sizeof(msg));
 	msg.device = vault_id;
 
 	printf("Encryption key: ");
@@ -217,6 +478,7 @@ static void sv_erase(uint8_t vault_id)
 	int errind;
 
 	struct msg_t msg;
+	memset(&msg, 0, sizeof(msg));
 	msg.device = vault_id;
 
 	errind = ioctl(ctl_fd, 5, &msg);
@@ -236,6 +498,7 @@ static void sv_delete(uint8_t vault_id)
 	int errind;
 
 	struct msg_t msg;
+	memset(&msg, 0, sizeof(msg));
 	msg.device = vault_id;
 
 	errind = ioctl(ctl_fd, 3, &msg);
@@ -245,6 +508,384 @@ static void sv_delete(uint8_t vault_id)
 	}
 }
 
+/**
+ * @brief Add a partition to the specified vault.
+ * @details Requests a key for the partition from the user.
+ * @param vault_id The id of the vault to alter.
+ * @param name The name of the partition.
+ * @param size The size of the partition.
+ * @param owner The user that is granted access to the partition.
+ */
+static void sv_add_partition(uint8_t vault_id, const char *name, unsigned long size, unsigned int owner)
+{
+	int errind;
+
+	struct part_msg_t msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.device = vault_id;
+	msg.size = size;
+	msg.owner = owner;
+	strcpy(msg.name, name);
+
+	printf("Encryption key: ");
+	fflush(stdout);
+	read_user_key(msg.key);
+
+	errind = ioctl(ctl_fd, SV_CTL_ADD_PARTITION, &msg);
+	if (errind == -1) {
+		fprintf(stderr, "[%s] ERROR: ioctl failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Remove a partition from the specified vault.
+ * @details Stored data of the partition will be lost.
+ * @param vault_id The id of the vault to alter.
+ * @param name The name of the partition.
+ */
+static void sv_del_partition(uint8_t vault_id, const char *name)
+{
+	int errind;
+
+	struct part_msg_t msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.device = vault_id;
+	strcpy(msg.name, name);
+
+	errind = ioctl(ctl_fd, SV_CTL_DEL_PARTITION, &msg);
+	if (errind == -1) {
+		fprintf(stderr, "[%s] ERROR: ioctl failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief Print information about the specified vault.
+ * @details The information is queried from the device of the vault, so only its owner can do so.
+ * @param vault_id The id of the vault to query.
+ */
+static void sv_info(uint8_t vault_id)
+{
+	struct vault_info_t info;
+	int fd;
+
+	fd = open_vault(vault_id, O_RDONLY);
+
+	if (ioctl(fd, VAULT_IOC_GET_INFO, &info) == -1) {
+		fprintf(stderr, "[%s] ERROR: ioctl failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
+
+	printf("size: %llu\n", info.size);
+	printf("used: %llu\n", info.used_space);
+	printf("generation: %llu\n", info.generation);
+}
+
+/**
+ * @brief Print the records of all vaults.
+ * @details The records of all vaults are read with a single call, without the ioctl device.
+ */
+static void sv_list(void)
+{
+	struct vault_record_t records[N_VAULTS];
+	ssize_t n;
+	int fd, i;
+
+	fd = open(RECORDS_PATH, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[%s] ERROR: open failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	n = read(fd, records, sizeof(records));
+	if (n < 0) {
+		fprintf(stderr, "[%s] ERROR: read failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
+
+	printf("%4s %8s %6s %10s %10s %10s %12s %6s %12s\n", "id", "flags", "owner", "size", "used", "storage",
+			"generation", "parts", "batched");
+
+	for (i = 0; i < n / (ssize_t)sizeof(records[0]); i++) {
+		if (!records[i].in_use)
+			continue;
+
+		printf("%4u %#8x %6u %10llu %10llu %10llu %12llu %6u %12llu\n", records[i].id, records[i].flags,
+				records[i].owner, records[i].size, records[i].used_space, records[i].storage,
+				records[i].generation, records[i].partitions, records[i].combined);
+	}
+}
+
+/**
+ * @brief Print the ranges in which two vaults differ.
+ * @details The program fails if the vaults differ, so the command can be used to verify a copy.
+ * @param vault_id The id of the first vault.
+ * @param other_id The id of the second vault.
+ */
+static void sv_diff(uint8_t vault_id, uint8_t other_id)
+{
+	struct diff_range_t ranges[MAX_DIFF_RANGES];
+	struct diff_msg_t msg;
+	unsigned long differing = 0;
+	unsigned int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.device = vault_id;
+	msg.other = other_id;
+	msg.ranges = (uintptr_t)ranges;
+	msg.max_ranges = MAX_DIFF_RANGES;
+
+	if (ioctl(ctl_fd, SV_CTL_DIFF, &msg) == -1) {
+		fprintf(stderr, "[%s] ERROR: ioctl failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < msg.n_ranges; i++) {
+		printf("offset %llu length %llu\n", ranges[i].offset, ranges[i].len);
+		differing += ranges[i].len;
+	}
+
+	printf("compared %llu differing %lu\n", msg.compared, differing);
+
+	if (msg.n_ranges > 0)
+		exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Get the current time of the monotonic clock.
+ * @return The current time in seconds.
+ */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Record the first error of a transfer.
+ * @param transfer The transfer that failed.
+ * @param error The error that occurred.
+ */
+static void transfer_fail(transfer_t *transfer, int error)
+{
+	int none = 0;
+
+	__atomic_compare_exchange_n(&transfer->error, &none, error, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Copy a range of a transfer.
+ * @details This is the entry point of each transfer thread. The range is copied with positional I/O through an aligned buffer, so threads never share a file offset.
+ * @param arg The range to copy.
+ * @return `NULL`.
+ */
+static void *transfer_range(void *arg)
+{
+	range_t *range = arg;
+	transfer_t *transfer = range->transfer;
+	unsigned long pos = range->start;
+	size_t chunk;
+	ssize_t n;
+	void *buffer;
+
+	if (posix_memalign(&buffer, TRANSFER_ALIGN, TRANSFER_BUFFER) != 0) {
+		transfer_fail(transfer, ENOMEM);
+		return NULL;
+	}
+
+	while (pos < range->end) {
+		chunk = range->end - pos < TRANSFER_BUFFER ? range->end - pos : TRANSFER_BUFFER;
+
+		n = pread(transfer->src_fd, buffer, chunk, pos);
+		if (n > 0)
+			n = pwrite(transfer->dst_fd, buffer, n, pos);
+
+		if (n <= 0) {
+			transfer_fail(transfer, n == 0 ? EIO : errno);
+			break;
+		}
+
+		pos += n;
+		__atomic_fetch_add(&transfer->done, n, __ATOMIC_RELAXED);
+	}
+
+	free(buffer);
+
+	return NULL;
+}
+
+/**
+ * @brief Try to copy a transfer within the kernel.
+ * @details `copy_file_range()` avoids the round trip through userspace, but the kernel only supports it between certain files.
+ * @param transfer The transfer to copy.
+ * @return `true` if the transfer was handled, `false` if the caller has to fall back to threads.
+ */
+static bool transfer_in_kernel(transfer_t *transfer)
+{
+	loff_t src_off = 0, dst_off = 0;
+	ssize_t n;
+
+	while (transfer->done < transfer->len) {
+		n = copy_file_range(transfer->src_fd, &src_off, transfer->dst_fd, &dst_off,
+				transfer->len - transfer->done, 0);
+
+		if (n < 0 && transfer->done == 0 && (errno == EINVAL || errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+			return false;
+
+		if (n <= 0) {
+			transfer_fail(transfer, n == 0 ? EIO : errno);
+			return true;
+		}
+
+		transfer->done += n;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Run a transfer and report progress and throughput.
+ * @details The data is split into disjoint, aligned ranges, one per thread.
+ * @param transfer The transfer to run.
+ * @param threads The number of threads to use.
+ */
+static void run_transfer(transfer_t *transfer, unsigned int threads)
+{
+	range_t ranges[MAX_THREADS];
+	unsigned long share;
+	struct timespec interval = { 0, PROGRESS_INTERVAL * 1000000L };
+	double start, elapsed;
+	unsigned int i;
+
+	start = now();
+
+	if (!transfer_in_kernel(transfer)) {
+		share = (transfer->len / threads + TRANSFER_ALIGN - 1) / TRANSFER_ALIGN * TRANSFER_ALIGN;
+
+		for (i = 0; i < threads; i++) {
+			ranges[i].transfer = transfer;
+			ranges[i].start = i * share < transfer->len ? i * share : transfer->len;
+			ranges[i].end = ranges[i].start + share < transfer->len ? ranges[i].start + share : transfer->len;
+
+			if (pthread_create(&ranges[i].thread, NULL, transfer_range, &ranges[i]) != 0) {
+				fprintf(stderr, "[%s] ERROR: could not create thread\n", progname);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		while (__atomic_load_n(&transfer->done, __ATOMIC_RELAXED) < transfer->len &&
+				__atomic_load_n(&transfer->error, __ATOMIC_RELAXED) == 0) {
+			fprintf(stderr, "\r%lu/%lu bytes", __atomic_load_n(&transfer->done, __ATOMIC_RELAXED), transfer->len);
+			nanosleep(&interval, NULL);
+		}
+
+		for (i = 0; i < threads; i++)
+			pthread_join(ranges[i].thread, NULL);
+	}
+
+	elapsed = now() - start;
+
+	if (transfer->error != 0) {
+		fprintf(stderr, "\n[%s] ERROR: transfer failed: %s\n", progname, strerror(transfer->error));
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stderr, "\r%lu/%lu bytes in %.3f s (%.1f MB/s)\n", transfer->done, transfer->len, elapsed,
+			elapsed > 0 ? transfer->done / elapsed / 1e6 : 0);
+}
+
+/**
+ * @brief Copy a file into the specified vault.
+ * @details The file must fit into the vault, whose previous content is erased first, so no data behind the end of the file survives.
+ * @param path The file to copy.
+ * @param vault_id The id of the vault to copy into.
+ * @param threads The number of threads to use.
+ */
+static void sv_put(const char *path, uint8_t vault_id, unsigned int threads)
+{
+	struct vault_info_t info;
+	transfer_t transfer;
+	struct stat st;
+
+	memset(&transfer, 0, sizeof(transfer));
+
+	transfer.src_fd = open(path, O_RDONLY);
+	if (transfer.src_fd < 0 || fstat(transfer.src_fd, &st) == -1) {
+		fprintf(stderr, "[%s] ERROR: could not open %s: %s\n", progname, path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	transfer.dst_fd = open_vault(vault_id, O_RDWR);
+
+	if (ioctl(transfer.dst_fd, VAULT_IOC_GET_INFO, &info) == -1) {
+		fprintf(stderr, "[%s] ERROR: ioctl failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if ((__u64)st.st_size > info.size) {
+		fprintf(stderr, "[%s] ERROR: %s does not fit into the secvault\n", progname, path);
+		exit(EXIT_FAILURE);
+	}
+
+	ctl_fd = open(SV_CTL, O_RDWR);
+	if (ctl_fd < 0) {
+		fprintf(stderr, "[%s] ERROR: open failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	sv_erase(vault_id);
+	close(ctl_fd);
+	ctl_fd = -1;
+
+	transfer.len = st.st_size;
+	run_transfer(&transfer, threads);
+
+	close(transfer.src_fd);
+	close(transfer.dst_fd);
+}
+
+/**
+ * @brief Copy the used content of the specified vault into a file.
+ * @details The file is created or truncated.
+ * @param vault_id The id of the vault to copy.
+ * @param path The file to copy into.
+ * @param threads The number of threads to use.
+ */
+static void sv_get(uint8_t vault_id, const char *path, unsigned int threads)
+{
+	struct vault_info_t info;
+	transfer_t transfer;
+
+	memset(&transfer, 0, sizeof(transfer));
+
+	transfer.src_fd = open_vault(vault_id, O_RDONLY);
+
+	if (ioctl(transfer.src_fd, VAULT_IOC_GET_INFO, &info) == -1) {
+		fprintf(stderr, "[%s] ERROR: ioctl failed: %s\n", progname, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	transfer.dst_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (transfer.dst_fd < 0 || ftruncate(transfer.dst_fd, info.used_space) == -1) {
+		fprintf(stderr, "[%s] ERROR: could not open %s: %s\n", progname, path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	transfer.len = info.used_space;
+	run_transfer(&transfer, threads);
+
+	close(transfer.src_fd);
+	close(transfer.dst_fd);
+}
+
 /**
  * @brief The entry point of the program.
  * @details This function is called upon program start. First, arguments will be parsed. Then, actions are performed to ensure execution of specified user instructions.
@@ -259,6 +900,21 @@ int main(int argc, char *argv[])
 	memset(&options, 0, sizeof(options));
 	parse_arguments(argc, argv, &options);
 
+	if (options.cmd == PUT) {
+		sv_put(options.path, options.vault_id, options.threads);
+		return EXIT_SUCCESS;
+	}
+
+	if (options.cmd == GET) {
+		sv_get(options.vault_id, options.path, options.threads);
+		return EXIT_SUCCESS;
+	}
+
+	if (options.cmd == LIST) {
+		sv_list();
+		return EXIT_SUCCESS;
+	}
+
 	ctl_fd = open(SV_CTL, O_RDWR);
 	if (ctl_fd < 0) {
 		fprintf(stderr, "[%s] ERROR: open failed: %s\n", progname, strerror(errno));
@@ -267,7 +923,7 @@ int main(int argc, char *argv[])
 
 	switch (options.cmd) {
 	case CREATE:
-		sv_create(options.vault_id, options.size);
+		sv_create(options.vault_id, options.size, options.flags, options.stripe_size);
 		break;
 	case CHANGE_KEY:
 		sv_change_key(options.vault_id);
@@ -278,6 +934,18 @@ int main(int argc, char *argv[])
 	case DELETE:
 		sv_delete(options.vault_id);
 		break;
+	case INFO:
+		sv_info(options.vault_id);
+		break;
+	case ADD_PARTITION:
+		sv_add_partition(options.vault_id, options.partition, options.size, options.part_owner);
+		break;
+	case DEL_PARTITION:
+		sv_del_partition(options.vault_id, options.partition);
+		break;
+	case DIFF:
+		sv_diff(options.vault_id, options.other_id);
+		break;
 	default:
 		assert(false);
 	}
@@ -0,0 +1,85 @@
+/**
+ * @file
+ * @author eikendev
+ * @date 2018-01-16
+ * @brief This module contains the client library for mapped vaults.
+ * @details The decryption loop is written so the compiler can vectorize it.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "svlib.h"
+
+/**
+ * @brief Decrypt one chunk of at most `SV_STREAM` bytes.
+ * @param dst The buffer to decrypt into.
+ * @param src The encrypted data.
+ * @param stream The key stream at the phase of the first byte.
+ * @param len The length of the chunk.
+ */
+static void xor_chunk(char *restrict dst, const char *restrict src, const unsigned char *restrict stream, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = src[i] ^ stream[i];
+}
+
+int sv_map(int fd, size_t size, struct sv_mapping *map)
+{
+	struct key_msg_t key_msg;
+	void *data;
+	size_t i;
+
+	if (ioctl(fd, VAULT_IOC_GET_KEY, &key_msg) == -1)
+		return -1;
+
+	data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		memset(&key_msg, 0, sizeof(key_msg));
+		return -1;
+	}
+
+	map->data = data;
+	map->size = size;
+	map->generation = key_msg.generation;
+
+	for (i = 0; i < sizeof(map->stream); i++)
+		map->stream[i] = key_msg.key[i % KEYSIZE];
+
+	memset(&key_msg, 0, sizeof(key_msg));
+
+	return 0;
+}
+
+void sv_unmap(struct sv_mapping *map)
+{
+	munmap((void *)map->data, map->size);
+	memset(map, 0, sizeof(*map));
+}
+
+size_t sv_read_mapped(const struct sv_mapping *map, char *buffer, size_t len, off_t offset)
+{
+	const unsigned char *stream;
+	size_t i, chunk;
+
+	if (offset < 0 || (size_t)offset >= map->size)
+		return 0;
+
+	if (len > map->size - offset)
+		len = map->size - offset;
+
+	// The stream is periodic in SV_STREAM, so every chunk starts at the same phase.
+	stream = map->stream + offset % KEYSIZE;
+
+	for (i = 0; i < len; i += chunk) {
+		chunk = len - i < SV_STREAM ? len - i : SV_STREAM;
+		xor_chunk(buffer + i, map->data + offset + i, stream, chunk);
+	}
+
+	return len;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file
+ * @author eikendev
+ * @date 2018-01-16
+ * @brief This module contains the client library for mapped vaults.
+ * @details Mapped vaults are decrypted in the calling process, so the kernel only enforces access and stores the data.
+ */
+
+#ifndef __SVLIB_H__
+#define __SVLIB_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "common.h"
+
+/**
+ * @brief The length of the precomputed key stream.
+ * @details It is a multiple of both the key size and the widest vector registers, so the stream can be applied in whole vectors.
+ */
+#define SV_STREAM (KEYSIZE * 64)
+
+/**
+ * @brief Struct of a vault mapped into the process.
+ */
+struct sv_mapping {
+	const char *data; ///< The encrypted data of the vault.
+	size_t size; ///< The size of the mapping.
+	unsigned long long generation; ///< The generation of the vault when the key was fetched, see `VAULT_IOC_GET_INFO`.
+	unsigned char stream[SV_STREAM + KEYSIZE]; ///< The key stream, starting at key index zero.
+};
+
+/**
+ * @brief Map a vault read-only and fetch its key handle.
+ * @details The key handle is not updated when the key of the vault changes. Callers that need to notice this compare the generation of the mapping with the one reported by `VAULT_IOC_GET_INFO`, and map the vault again.
+ * @param fd The file descriptor of the opened vault.
+ * @param size The size of the vault.
+ * @param map The mapping to set up.
+ * @return `0` on success, `-1` otherwise, with `errno` set.
+ */
+int sv_map(int fd, size_t size, struct sv_mapping *map);
+
+/**
+ * @brief Unmap a vault and wipe its key stream.
+ * @param map The mapping to release.
+ */
+void sv_unmap(struct sv_mapping *map);
+
+/**
+ * @brief Read and decrypt data from a mapped vault.
+ * @details The range is clamped to the size of the mapping.
+ * @param map The mapping to read from.
+ * @param buffer The buffer to read into.
+ * @param len The length of the buffer.
+ * @param offset The offset in the vault to read from.
+ * @return The number of bytes read.
+ */
+size_t sv_read_mapped(const struct sv_mapping *map, char *buffer, size_t len, off_t offset);
+
+#endif
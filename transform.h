@@ -0,0 +1,110 @@
+/**
+ * @file
+ * @author eikendev
+ * @date 2018-01-16
+ * @brief This module contains the multi-buffer transform shared by the kernel module and the benchmarks.
+ * @details Up to `TRANSFORM_LANES` independent buffers, each with its own key and offset, are encrypted or decrypted in one pass. The buffers are processed in words of eight bytes in lockstep, so the work of independent lanes overlaps and the per-call setup is paid once per batch instead of once per buffer.
+ */
+
+#ifndef __TRANSFORM_H__
+#define __TRANSFORM_H__
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/string.h>
+#else
+#include <stddef.h>
+#include <string.h>
+#endif
+
+#include "common.h"
+
+#ifdef __KERNEL__
+#define transform_wipe(buffer, len) memzero_explicit(buffer, len)
+#else
+#define transform_wipe(buffer, len) memset(buffer, 0, len)
+#endif
+
+/**
+ * @brief The maximum number of buffers transformed in one pass.
+ */
+#define TRANSFORM_LANES 8
+
+/**
+ * @brief The size of the words the buffers are transformed in.
+ */
+#define TRANSFORM_WORD 8
+
+/**
+ * @brief The number of words after which the key stream repeats.
+ */
+#define TRANSFORM_PERIOD KEYSIZE
+
+/**
+ * @brief Struct of one buffer of a multi-buffer transform.
+ */
+struct transform_lane {
+	char *buffer; ///< The buffer to encrypt or decrypt in place.
+	size_t len; ///< The length of the buffer.
+	unsigned long offset; ///< The offset of the encryption cursor at the start of the buffer.
+	const char *key; ///< The key to apply.
+};
+
+/**
+ * @brief Encrypt or decrypt up to `TRANSFORM_LANES` buffers in one pass.
+ * @details The key stream of every lane is expanded into words once, at most for one period. Then word `i` of all lanes is transformed before word `i + 1`, and the bytes that do not fill a word are transformed last.
+ * @param lanes The buffers to transform.
+ * @param n The number of buffers, at most `TRANSFORM_LANES`.
+ */
+static inline void transform_lanes(const struct transform_lane *lanes, unsigned int n)
+{
+	unsigned long long stream[TRANSFORM_LANES][TRANSFORM_PERIOD];
+	size_t words[TRANSFORM_LANES];
+	size_t max_words = 0, w, i;
+	unsigned long long word;
+	unsigned int j, k, phase;
+	char *bytes;
+
+	for (j = 0; j < n; j++) {
+		words[j] = lanes[j].len / TRANSFORM_WORD;
+		if (words[j] > max_words)
+			max_words = words[j];
+
+		// The stream is the rotated key repeated, short buffers only need the part they cover.
+		bytes = (char *)stream[j];
+		k = lanes[j].offset % KEYSIZE;
+		memcpy(bytes, lanes[j].key + k, KEYSIZE - k);
+		memcpy(bytes + KEYSIZE - k, lanes[j].key, k);
+
+		for (i = KEYSIZE; i < TRANSFORM_WORD * TRANSFORM_PERIOD && i < words[j] * TRANSFORM_WORD; i += KEYSIZE)
+			memcpy(bytes + i, bytes, KEYSIZE);
+	}
+
+	for (w = 0, phase = 0; w < max_words; w++) {
+		for (j = 0; j < n; j++) {
+			if (w >= words[j])
+				continue;
+
+			memcpy(&word, lanes[j].buffer + w * TRANSFORM_WORD, TRANSFORM_WORD);
+			word ^= stream[j][phase];
+			memcpy(lanes[j].buffer + w * TRANSFORM_WORD, &word, TRANSFORM_WORD);
+		}
+
+		if (++phase == TRANSFORM_PERIOD)
+			phase = 0;
+	}
+
+	for (j = 0; j < n; j++) {
+		i = words[j] * TRANSFORM_WORD;
+		k = (lanes[j].offset + i) % KEYSIZE;
+		for (; i < lanes[j].len; i++) {
+			lanes[j].buffer[i] ^= lanes[j].key[k];
+			if (++k == KEYSIZE)
+				k = 0;
+		}
+	}
+
+	transform_wipe(stream, sizeof(stream));
+}
+
+#endif
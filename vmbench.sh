@@ -0,0 +1,142 @@
+#!/bin/sh
+#
+# Run the benchmarks of svbench against secvault.ko inside a minimal VM.
+#
+# The module is built for the given kernel with the `module` target of the
+# Makefile, and the VM is booted with virtme-ng from that kernel tree, with a
+# fixed number of vCPUs pinned to fixed host CPUs, fixed memory and no network.
+# Each run stores the output of every benchmark and the configuration it ran
+# with in its own directory below `vmbench-results`, named after the commit.
+#
+# Usage: ./vmbench.sh [-k <kernel dir>] [-c <vcpus>] [-m <memory>] [-p <host cpus>] [-t] [<benchmark>...]
+#   -k  kernel build tree to boot and build against, the running kernel by default
+#   -c  number of vCPUs, 4 by default
+#   -m  memory of the VM, 2G by default
+#   -p  host CPUs to pin the VM to, 0 to <vcpus> - 1 by default
+#   -t  emulate with QEMU TCG instead of KVM, slower but independent of the host CPU
+#   The benchmarks default to combine, hotread, striped, dedup, mapped and zerocopy.
+
+set -eu
+
+progname=$0
+
+KDIR=/lib/modules/$(uname -r)/build
+KERNEL=
+CPUS=4
+MEMORY=2G
+PIN=
+TCG=0
+BENCHMARKS="combine hotread striped dedup mapped zerocopy"
+VAULT_ID=0
+
+usage() {
+	sed -n 's/^# \{0,1\}//; /^Usage:/,/The benchmarks/p' "$0" >&2
+	exit 1
+}
+
+die() {
+	echo "[$progname] ERROR: $*" >&2
+	exit 1
+}
+
+# Run inside the VM: load the module, run every benchmark and unload it.
+guest() {
+	out=$1
+	shift
+
+	mountpoint -q /sys/kernel/debug || mount -t debugfs none /sys/kernel/debug
+
+	insmod ./secvault.ko
+	make -s install
+
+	uname -a > "$out/guest.txt"
+	nproc >> "$out/guest.txt"
+	grep MemTotal /proc/meminfo >> "$out/guest.txt"
+
+	status=0
+
+	for bench in "$@"; do
+		echo "== $bench"
+
+		if ! ./svbench "$bench" "$VAULT_ID" > "$out/$bench.txt" 2>&1; then
+			echo "$bench failed" >> "$out/failed.txt"
+			status=1
+		fi
+
+		cat "$out/$bench.txt"
+		cp /sys/kernel/debug/secvault/stats "$out/$bench.stats"
+	done
+
+	make -s purge
+	rmmod secvault
+
+	exit $status
+}
+
+if [ "${1:-}" = "--guest" ]; then
+	shift
+	guest "$@"
+fi
+
+while getopts k:c:m:p:t opt; do
+	case $opt in
+	k) KDIR=$OPTARG KERNEL=$OPTARG ;;
+	c) CPUS=$OPTARG ;;
+	m) MEMORY=$OPTARG ;;
+	p) PIN=$OPTARG ;;
+	t) TCG=1 ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -gt 0 ]; then
+	BENCHMARKS="$*"
+fi
+
+case $CPUS in
+''|*[!0-9]*|0) usage ;;
+esac
+
+[ -n "$PIN" ] || PIN="0-$((CPUS - 1))"
+
+command -v vng > /dev/null || die "virtme-ng (vng) is required"
+command -v taskset > /dev/null || die "taskset is required"
+[ -d "$KDIR" ] || die "kernel tree $KDIR does not exist"
+
+cd "$(dirname "$0")"
+
+commit=$(git rev-parse --short HEAD 2> /dev/null || echo unknown)
+git diff --quiet HEAD 2> /dev/null || commit="$commit-dirty"
+
+out=vmbench-results/$commit-$(date +%Y%m%d-%H%M%S)
+mkdir -p "$out"
+
+make -s module KDIR="$KDIR"
+make -s svctl svbench
+
+accel=kvm
+accel_opt=
+if [ "$TCG" -eq 1 ] || [ ! -w /dev/kvm ]; then
+	accel=tcg
+	accel_opt=--disable-kvm
+fi
+
+{
+	echo "commit $commit"
+	echo "kernel $KDIR"
+	echo "vcpus $CPUS pinned $PIN"
+	echo "memory $MEMORY"
+	echo "accel $accel"
+	echo "host $(uname -r) $(grep -m1 'model name' /proc/cpuinfo | cut -d: -f2 | sed 's/^ //')"
+	echo "benchmarks $BENCHMARKS"
+} > "$out/config.txt"
+
+# The VM shares the tree read-only, so only the results are writable. Without
+# a kernel tree, vng boots the running kernel.
+# shellcheck disable=SC2086
+taskset -c "$PIN" vng --run $KERNEL --cpus "$CPUS" --memory "$MEMORY" $accel_opt \
+	--user root --rwdir "$out" \
+	--exec "sh ./vmbench.sh --guest $out $BENCHMARKS"
+
+echo "Results stored in $out"